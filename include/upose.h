@@ -7,6 +7,20 @@
  */
 
 #include <opencv2/opencv.hpp>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <upose_optimize.h>
 
 #define countof(arr) (sizeof(arr) / sizeof(arr[0]))
 
@@ -25,37 +39,896 @@ namespace upose {
         JOINT_ELBOWR = 2,
     };
 
-    void visualizeUpperSkeleton(cv::Mat image, Features2D f, UpperBodySkeleton skel);
+    enum {
+        UPPER_BODY_SEGMENTS = 4, /* hand-elbow, elbow-shoulder per side */
+        MODEL_RADIUS = 25, /* half-thickness of a limb in the body model */
+        MAX_CAPSULES = 8,
+        CHAMFER_STEP = 4, /* sampling interval along a limb, in pixels */
+        CHAMFER_TRUNCATION = 32, /* distances beyond this count as a miss */
+        PIPELINE_DEPTH = 3, /* frames in flight in pipelined mode */
+        BACKGROUND_RATE = 5, /* background adapts by 1/2^rate per frame... */
+        FOREGROUND_RATE = 8, /* ...and more slowly under the foreground */
+        ROI_PADDING = 32, /* margin around the person's box, plus a quarter of its size */
+        ROI_REFRESH = 30, /* frames between full-frame passes */
+        MAX_PYRAMID_LEVELS = 4, /* coarse-to-fine levels, each half the last */
+        FRAME_RING = PIPELINE_DEPTH + 1, /* frames in flight, plus the one being read */
+        MOTION_THRESHOLD = 16, /* change that counts as motion for the background */
+        MOTION_SATURATION = 64, /* motion energy beyond this earns no more reward */
+        MAX_TRACKED_BLOBS = 8, /* largest skin blobs considered for the face and hands */
+        TRACK_GATE = 160 /* farthest a tracked part may move between frames, in pixels */
+    };
+
+    int capsuleSum(const cv::Mat& sat, const cv::Point* lines, size_t count, int radius, int band);
+
+    /* fused per-pixel foreground and skin tests, before any morphology, and
+     * motion energy against the previous frame (which may be empty) */
+    void segmentPixels(const cv::Mat& frame, const cv::Mat& background, const cv::Mat& previous,
+                       cv::Mat& foreground, cv::Mat& skin, cv::Mat& motion);
+
+    /* blends a frame into the 8.8 fixed-point background model, in place */
+    void updateBackground(const cv::Mat& frame, const cv::Mat& foreground,
+                          cv::Mat& background, cv::Mat& fraction);
+
+    /* the result of a single step: tracked 2D features and fitted skeleton */
+    struct Pose {
+        Features2D features;
+        UpperBodySkeleton skeleton;
+
+        /* false when nothing was fitted: the source has run dry, or
+         * process() was handed an empty frame or only learnt the background
+         * from it. the features and skeleton then repeat the last ones */
+        bool valid;
+    };
+
+    void visualizeUpperSkeleton(cv::Mat image, Features2D f, const UpperBodySkeleton skel);
+
+    /**
+     * edge pixels bucketed into square cells CHAMFER_TRUNCATION pixels wide,
+     * so the nearest edge within the truncation distance is among the points
+     * of the 3x3 cells around a query. the sparse alternative to a distance
+     * transform: nothing is computed per pixel, but each query scans points
+     */
+
+    class EdgeGrid {
+        public:
+            EdgeGrid() : m_cols(0), m_rows(0) {}
+
+            /* buckets the nonzero pixels of a CV_8U edge map covering the frame from origin */
+            void build(const cv::Mat& edges, cv::Point origin);
+            void clear();
+
+            /* not built */
+            bool empty() const { return m_start.empty(); }
+
+            /* in frame coordinates, grouped by cell */
+            const std::vector<cv::Point>& points() const { return m_points; }
+
+            /* distance from p, in frame coordinates, to the nearest edge
+             * pixel, or CHAMFER_TRUNCATION if there is none closer */
+            float nearest(cv::Point p) const;
+
+        private:
+            cv::Point m_origin;
+            int m_cols, m_rows;
+            std::vector<int> m_start; /* where each cell's points begin, then the end */
+            std::vector<cv::Point> m_points, m_unsorted;
+    };
 
     class Human {
         public:
+            Human() : levels(1) {}
+
             Human(cv::Mat _foreground, cv::Mat _skinRegions, cv::Mat _edgeImage, Features2D _projected) :
                                         foreground(_foreground),
                                         skinRegions(_skinRegions),
                                         edgeImage(_edgeImage),
-                                        projected(_projected) {}
+                                        projected(_projected),
+                                        levels(1) {}
 
             cv::Mat foreground, skinRegions, edgeImage;
             Features2D projected;
+
+            /* motion energy: the largest channel change since the previous frame */
+            cv::Mat motion;
+
+            /* summed-area table (CV_32S) of the foreground mask, 255 per pixel */
+            cv::Mat foregroundIntegral;
+
+            /* the region of the frame covered by the maps; coordinates in
+             * projected and the skeleton are in the full frame */
+            cv::Rect roi;
+
+            /* distance to the nearest edge pixel (CV_32F), built once per
+             * frame; level l is the edge map downsampled by 2^l */
+            cv::Mat chamfer[MAX_PYRAMID_LEVELS];
+            int levels;
+
+            /* the edge pixels, built instead of chamfer when requested
+             * (Context::setEdgePoints); the cost uses whichever is there */
+            EdgeGrid edgePoints;
     };
 
-    class Context {
+    /* cost of a candidate skeleton against the per-frame maps at a pyramid
+     * level; lower is better */
+    int costFunction2D(const int* skel, const Human& human, int level = 0);
+
+    /**
+     * visualization sink: called at the end of each step with the input frame,
+     * the per-frame maps, and the fitted pose. the frame is shared with the
+     * Context, so sinks must draw on a copy. leave unset to run headless;
+     * the library itself never opens a window (see test/webcam.cpp for a
+     * HighGUI sink)
+     */
+
+    typedef std::function<void(cv::Mat, const Human&, const Pose&)> VisualizationSink;
+
+    struct PerfTally;
+
+    /**
+     * a work-stealing pool of worker threads. runs both independent tasks
+     * and data-parallel loops, such as evaluating a batch of candidate
+     * skeletons; loops may nest inside tasks. may be shared by contexts
+     */
+
+    class ThreadPool {
         public:
-            Context(cv::VideoCapture& camera);
+            typedef std::function<void()> Task;
 
-            void step();
+            enum {
+                QUEUE_CAPACITY = 64 /* tasks per worker before its queue grows */
+            };
+
+            /* 0 threads picks the hardware concurrency */
+            explicit ThreadPool(int threads = 0);
+            ~ThreadPool();
+
+            /* runs task soon; from a worker, before the tasks it already queued */
+            void submit(Task task);
+
+            /* runs task after the tasks already queued, for work that takes
+             * turns, such as a task that resubmits itself */
+            void post(Task task);
+
+            /* runs body(i) for every i in [0, count) on the workers and the
+             * calling thread, returning once all are done. given a tally,
+             * the helpers' hardware counts are added to it */
+            void parallelFor(int count, const std::function<void(int)>& body, PerfTally* tally = NULL);
+
+            int size() const;
+
+        private:
+            /**
+             * a worker's tasks, in a ring that doubles when full. a deque
+             * would allocate a node every few pushes; the ring stops
+             * allocating once it has held the most tasks queued at once
+             */
+
+            struct Queue {
+                Queue() : tasks(QUEUE_CAPACITY), head(0), count(0) {}
+
+                void grow();
+                void pushBack(Task& task);
+                void pushFront(Task& task);
+                void popBack(Task& task);
+                void popFront(Task& task);
+
+                std::mutex lock;
+                std::vector<Task> tasks;
+                size_t head, count;
+            };
+
+            void enqueue(Task& task, bool behind);
+            void work(int index);
+            bool runOne();
+
+            std::vector<std::thread> m_threads;
+            std::unique_ptr<Queue[]> m_queues;
+            int m_queueCount;
+
+            std::mutex m_sleep;
+            std::condition_variable m_wake;
+            std::atomic<int> m_pending;
+            std::atomic<unsigned int> m_submitted;
+            bool m_quit;
+    };
+
+    /**
+     * the parallel argument of optimize() for a step: runs a batch of
+     * evaluations on the pool, or serially without one
+     */
+
+    class PoolFor {
+        public:
+            explicit PoolFor(ThreadPool* pool, PerfTally* tally = NULL) : m_pool(pool), m_tally(tally) {}
+
+            void operator()(int count, const std::function<void(int)>& body) const {
+                if(m_pool) {
+                    m_pool->parallelFor(count, body, m_tally);
+                } else {
+                    for(int i = 0; i < count; ++i) body(i);
+                }
+            }
+
+        private:
+            ThreadPool* m_pool;
+            PerfTally* m_tally;
+    };
+
+    /**
+     * bounded lock-free queue for one producer and one consumer thread
+     * Capacity must be a power of two
+     */
+
+    template<typename T, unsigned int Capacity>
+    class SPSCQueue {
+        public:
+            SPSCQueue() : m_head(0), m_tail(0) {}
+
+            /* producer side; false if full */
+            bool push(const T& item) {
+                unsigned int tail = m_tail.load(std::memory_order_relaxed);
+
+                if(tail - m_head.load(std::memory_order_acquire) == Capacity) return false;
+
+                m_items[tail % Capacity] = item;
+                m_tail.store(tail + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            /* consumer side; false if empty */
+            bool pop(T& item) {
+                unsigned int head = m_head.load(std::memory_order_relaxed);
+
+                if(head == m_tail.load(std::memory_order_acquire)) return false;
+
+                item = m_items[head % Capacity];
+                m_head.store(head + 1, std::memory_order_release);
+
+                return true;
+            }
+
+        private:
+            T m_items[Capacity];
+
+            /* padded apart, so the two sides do not false-share a cache line */
+            std::atomic<unsigned int> m_head;
+            char m_padding[64];
+            std::atomic<unsigned int> m_tail;
+    };
+
+    /* pops, spinning then sleeping while empty; false if running drops first */
+
+    template<typename Queue, typename T>
+    bool waitPop(Queue& queue, T& item, const std::atomic<bool>& running) {
+        for(int spin = 0; !queue.pop(item); ++spin) {
+            if(!running) return false;
+
+            if(spin < 64) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * preallocated per-frame images. each buffer grows to the largest size
+     * asked of it, normally the full frame on the first one, and is handed
+     * out as a view of the size requested, so a region of interest changing
+     * from frame to frame does not reallocate. allocations() counts every
+     * (re)allocation; in steady state it stops moving. it counts only these
+     * buffers: test/allocations.cpp counts every allocation of a frame
+     */
+
+    class MatArena {
+        public:
+            enum Buffer {
+                BUFFER_RAW_FOREGROUND = 0,
+                BUFFER_RAW_SKIN,
+                BUFFER_ERODED_SKIN,
+                BUFFER_FOREGROUND,
+                BUFFER_SKIN,
+                BUFFER_LABEL,
+                BUFFER_SCRATCH,
+                BUFFER_EDGES,
+                BUFFER_NON_EDGES,
+                BUFFER_MOTION,
+                BUFFER_HELD,
+                BUFFER_FOREGROUND_INTEGRAL,
+                BUFFER_BLOB_LABELS,
+                BUFFER_EDGE_LEVEL,
+                BUFFER_CHAMFER = BUFFER_EDGE_LEVEL + MAX_PYRAMID_LEVELS,
+                BUFFER_COUNT = BUFFER_CHAMFER + MAX_PYRAMID_LEVELS
+            };
+
+            MatArena() : m_allocations(0) {}
+
+            cv::Mat get(int buffer, cv::Size size, int type);
+
+            /* may be read from another thread, such as while pipelined */
+            uint64_t allocations() const { return m_allocations; }
+
+        private:
+            cv::Mat m_buffers[BUFFER_COUNT];
+            std::atomic<uint64_t> m_allocations;
+    };
+
+    /**
+     * statistics of the skin blobs of a frame, one entry per blob in flat
+     * arrays. the arrays are refilled rather than freed between frames, so
+     * they stop allocating once they reach the most blobs seen
+     */
+
+    struct BlobStats {
+        std::vector<int> area;
+        std::vector<cv::Rect> box; /* in frame coordinates */
+        std::vector<cv::Point> centre; /* of the box */
+
+        size_t size() const { return area.size(); }
+
+        /* tallies a CV_32S label image with the given number of labels, label
+         * 0 being the background; blob i is label i + 1 */
+        void load(const cv::Mat& labels, int count, cv::Point origin);
+    };
+
+    /* traces the outer border of a blob of a label image into contour, as
+     * cv::findContours would with CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE */
+    void traceOutline(const cv::Mat& labels, int label, cv::Rect box, cv::Point offset,
+                      std::vector<cv::Point>& contour);
+
+    /* parts tracked from skin blobs */
+    enum BodyPart {
+        PART_FACE = 0,
+        PART_LEFT_HAND,
+        PART_RIGHT_HAND,
+        BODY_PARTS
+    };
+
+    /* depth first over the parts; used is the set of blobs already taken */
+
+    template<int Parts, int Blobs>
+    void assignSearch(const int (&costs)[Blobs][Parts], int blobs, const int (&gate)[Parts],
+                      int part, unsigned used, int total,
+                      int (&current)[Parts], int& best, int (&assignment)[Parts]) {
+        if(part == Parts) {
+            if(total < best) {
+                best = total;
+                std::copy(current, current + Parts, assignment);
+            }
+
+            return;
+        }
+
+        current[part] = -1;
+        assignSearch(costs, blobs, gate, part + 1, used, total + gate[part], current, best, assignment);
+
+        for(int b = 0; b < blobs; ++b) {
+            if((used & (1u << b)) || costs[b][part] >= gate[part]) continue;
+
+            current[part] = b;
+            assignSearch(costs, blobs, gate, part + 1, used | (1u << b), total + costs[b][part],
+                         current, best, assignment);
+        }
+    }
+
+    /**
+     * jointly assigns blobs to parts, each blob to at most one part, for the
+     * least total cost. costs[b][p] at or above gate[p] rule the pairing
+     * out, and leaving a part unassigned (-1) costs its gate. exhaustive over
+     * partial permutations: at most (Blobs + 1)^Parts leaves, which for a
+     * few parts and blobs beats the bookkeeping of the Hungarian method
+     */
+
+    template<int Parts, int Blobs>
+    int assignParts(const int (&costs)[Blobs][Parts], int blobs, const int (&gate)[Parts],
+                    int (&assignment)[Parts]) {
+        static_assert(Blobs <= 32, "blobs are tracked in a 32-bit set");
+
+        int current[Parts], best = INT_MAX;
+        assignSearch(costs, std::min(blobs, Blobs), gate, 0, 0, 0, current, best, assignment);
+
+        return best;
+    }
+
+    /**
+     * where a Context gets its frames. read() fills frame with the next BGR
+     * frame (CV_8UC3), reusing its buffer where it can, and returns false
+     * once the source is exhausted
+     */
+
+    class FrameSource {
+        public:
+            virtual ~FrameSource() {}
+
+            virtual bool read(cv::Mat& frame) = 0;
+    };
+
+    /* a camera or video file opened by OpenCV */
+    class VideoCaptureSource : public FrameSource {
+        public:
+            explicit VideoCaptureSource(cv::VideoCapture& camera) : m_camera(camera) {}
+
+            bool read(cv::Mat& frame);
 
         private:
             cv::VideoCapture& m_camera;
+    };
+
+    /**
+     * frames already in memory, handed out as headers without copying, in
+     * order and optionally forever. the frames must outlive the source
+     */
+
+    class MemorySource : public FrameSource {
+        public:
+            MemorySource(const std::vector<cv::Mat>& frames, bool loop = false) :
+                                        m_frames(frames),
+                                        m_next(0),
+                                        m_loop(loop) {}
+
+            bool read(cv::Mat& frame);
+
+        private:
+            const std::vector<cv::Mat>& m_frames;
+            size_t m_next;
+            bool m_loop;
+    };
+
+    /* headerless packed BGR24 frames of a known size, read straight into the frame */
+    class RawSource : public FrameSource {
+        public:
+            RawSource(const std::string& path, cv::Size size);
+            ~RawSource();
+
+            bool read(cv::Mat& frame);
+
+        private:
+            FILE* m_file;
+            cv::Size m_size;
+    };
+
+    /* YUV4MPEG2 streams in 4:2:0, as written by ffmpeg and most tools */
+    class Y4MSource : public FrameSource {
+        public:
+            explicit Y4MSource(const std::string& path);
+            ~Y4MSource();
+
+            bool read(cv::Mat& frame);
+
+            cv::Size size() const { return m_size; }
+
+        private:
+            FILE* m_file;
+            cv::Size m_size;
+            cv::Mat m_yuv;
+    };
+
+    /**
+     * frames pushed by the caller from another thread, such as a custom
+     * ingest path. read() blocks until a frame arrives or the source is
+     * closed. push() copies the frame, so the pusher may reuse its buffer as
+     * soon as push() returns; a context keeps frames for a while after
+     * reading them (motion cue, sinks, pipelined slots), so it is never
+     * handed the pusher's own. the copies go to buffers that read() takes
+     * back from the reader, so steady pushing does not allocate
+     */
+
+    class PushSource : public FrameSource {
+        public:
+            PushSource() : m_closed(false) {}
+
+            void push(const cv::Mat& frame);
+
+            /* ends the stream once the queued frames are read */
+            void close();
+
+            bool read(cv::Mat& frame);
+
+        private:
+            std::mutex m_lock;
+            std::condition_variable m_ready;
+            std::deque<cv::Mat> m_frames;
+            std::vector<cv::Mat> m_spare; /* buffers handed back by read() */
+            bool m_closed;
+    };
+
+    /* the parts of a frame's processing that are timed separately */
+    enum Stage {
+        STAGE_READ = 0, /* reading the frame from its source */
+        STAGE_SEGMENT, /* foreground, skin and motion, and the background update */
+        STAGE_EDGES,
+        STAGE_DISTANCE, /* foreground integral, and distance transforms or the edge grid */
+        STAGE_TRACK, /* skin blobs to face and hands */
+        STAGE_OPTIMIZE,
+        STAGE_VISUALIZE, /* the visualization sink, when set */
+        STAGE_STEP, /* a whole step() or process(), as its caller sees it */
+        STAGE_COUNT
+    };
+
+    const char* stageName(Stage stage);
+
+    /* latency summary of a stage, in nanoseconds */
+    struct StageStats {
+        uint64_t count;
+        double mean;
+        uint64_t p50, p90, p99, max;
+    };
+
+    /**
+     * log-linear latency histogram in the manner of HdrHistogram: 16 linear
+     * buckets per power of two, so each value is kept to within 1/16, from
+     * 1 ns up to 2^40 ns (18 minutes) in under 5 KB. recording is a few
+     * relaxed atomic operations, safe from any thread without a lock.
+     * building with UPOSE_NO_STATS compiles the histograms, timers, tracing
+     * and counters away
+     */
+
+    class LatencyHistogram {
+        public:
+            enum {
+                SUB_BUCKETS = 16,
+                MAX_EXPONENT = 39, /* larger values land in the last bucket */
+                BUCKETS = (MAX_EXPONENT - 2) * SUB_BUCKETS
+            };
+
+#ifndef UPOSE_NO_STATS
+            LatencyHistogram() { reset(); }
+
+            void record(uint64_t nanoseconds);
+            StageStats summary() const;
+
+            /* values recorded concurrently with a reset may be partly kept */
+            void reset();
+
+        private:
+            static int bucket(uint64_t value);
+            static uint64_t bucketValue(int bucket);
+
+            std::atomic<uint64_t> m_counts[BUCKETS];
+            std::atomic<uint64_t> m_count, m_sum, m_max;
+#else
+            void record(uint64_t) {}
+            StageStats summary() const { StageStats none = { 0, 0, 0, 0, 0, 0 }; return none; }
+            void reset() {}
+#endif
+    };
+
+    /**
+     * process-wide timeline of stage spans, for chrome://tracing or Perfetto.
+     * off by default. each thread appends to its own ring of the last
+     * TRACE_EVENTS spans, so recording takes no lock; rings outlive their
+     * threads so a dump sees pool workers that have exited. dump while no
+     * context is stepping, or the oldest spans of a busy ring may be torn
+     */
 
-            cv::Mat m_background, m_lastFrame;
-            cv::Mat backgroundSubtract(cv::Mat frame);
-            cv::Mat skinRegions(cv::Mat frame, cv::Mat foreground);
-            cv::Mat edges(cv::Mat frame);
+    class Tracer {
+        public:
+            enum { TRACE_EVENTS = 1 << 14 };
+
+            typedef std::chrono::steady_clock::time_point Time;
+
+            static void enable(bool enabled);
+            static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+            /* a span of a stage of the given context on the calling thread */
+            static void record(Stage stage, int context, Time start, Time end);
+
+            /* writes the spans as Chrome trace event JSON; false if the file fails */
+            static bool dump(const std::string& path);
+            static void clear();
+
+        private:
+            static std::atomic<bool> s_enabled;
+    };
+
+    /* hardware event counts over part of one thread's execution */
+    struct PerfSample {
+        uint64_t cycles, instructions, cacheMisses, branchMisses;
+    };
+
+    /**
+     * reads the calling thread's hardware counters, user mode only, opening
+     * them with perf_event_open on first use. false where they cannot be
+     * had: outside Linux, in most VMs, or with perf_event_paranoid above 2.
+     * an event the CPU lacks reads as zero
+     */
+
+    bool readPerfCounters(PerfSample& sample);
+
+    /* counts summed over work a stage hands to other threads, such as a pool's helpers */
+    struct PerfTally {
+        PerfTally() : cycles(0), instructions(0), cacheMisses(0), branchMisses(0) {}
+
+        void add(const PerfSample& start, const PerfSample& end);
+
+        std::atomic<uint64_t> cycles, instructions, cacheMisses, branchMisses;
+    };
+
+    /* the counters of a stage: over its latest run, normally the last frame, and in total */
+    struct StagePerf {
+        PerfSample last, total;
+        uint64_t runs;
+    };
+
+    /**
+     * what a Context records about its stages: latency histograms always,
+     * hardware counters when counting. a stage runs on one thread at a time,
+     * so the lock on the counters only ever waits for readers
+     */
+
+    class StageRecorder {
+        public:
+            StageRecorder() : context(0), counting(false) { reset(); }
+
+            LatencyHistogram histograms[STAGE_COUNT];
+            int context; /* tells contexts apart in traces */
+            std::atomic<bool> counting;
+
+            /* the calling thread's counts from start to end, plus the helpers' */
+            void recordPerf(Stage stage, const PerfSample& start, const PerfSample& end,
+                            const PerfTally& helpers);
+            StagePerf perf(Stage stage) const;
+
+            void reset();
+
+        private:
+            mutable std::mutex m_lock;
+            StagePerf m_perf[STAGE_COUNT];
+    };
+
+    /**
+     * records its scope into the stage's histogram, counters and trace. the
+     * counters are read outside the timed interval, and the clock outside
+     * the counted one, so neither measures the other. work handed to other
+     * threads is counted through helpers(), which is NULL when not counting
+     */
+
+    class StageTimer {
+        public:
+#ifndef UPOSE_NO_STATS
+            StageTimer(StageRecorder& recorder, Stage stage) :
+                                        m_recorder(recorder),
+                                        m_stage(stage),
+                                        m_counting(recorder.counting.load(std::memory_order_relaxed)
+                                                   && readPerfCounters(m_counters)),
+                                        m_start(std::chrono::steady_clock::now()) {}
+
+            ~StageTimer() {
+                Tracer::Time end = std::chrono::steady_clock::now();
+                PerfSample counters;
+
+                if(m_counting && readPerfCounters(counters)) {
+                    m_recorder.recordPerf(m_stage, m_counters, counters, m_helpers);
+                }
+
+                m_recorder.histograms[m_stage].record(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(end - m_start).count());
+
+                if(Tracer::enabled()) Tracer::record(m_stage, m_recorder.context, m_start, end);
+            }
+
+            PerfTally* helpers() { return m_counting ? &m_helpers : NULL; }
+
+        private:
+            StageRecorder& m_recorder;
+            Stage m_stage;
+            PerfSample m_counters;
+            PerfTally m_helpers;
+            bool m_counting;
+            Tracer::Time m_start;
+#else
+            StageTimer(StageRecorder&, Stage) {}
+
+            PerfTally* helpers() { return NULL; }
+#endif
+    };
+
+    /* a frame and its per-frame maps, handed from capture to fitting */
+    struct FrameSlot {
+        cv::Mat frame;
+        Human human;
+        MatArena arena;
+    };
+
+    class Context {
+        public:
+            Context(cv::VideoCapture& camera, uint64_t seed = 1);
+            Context(FrameSource& source, uint64_t seed = 1);
+
+            /* without a source; frames are fed to process(), the first of
+             * which becomes the initial background, as does the first at a
+             * new resolution */
+            explicit Context(uint64_t seed = 1);
+
+            ~Context();
+
+            Pose step();
+
+            /**
+             * runs both stages on a frame from the caller, without copying it.
+             * the frame is kept as the previous frame for the motion cue, so
+             * it must not change until the next call. not for pipelined mode.
+             * the pose is invalid for an empty frame and for a frame that
+             * only teaches the background (the first, or the first at a new
+             * resolution)
+             */
+            Pose process(const cv::Mat& frame);
+
+            /* captures and segments ahead on a separate thread while step()
+             * fits the skeleton; call before stepping */
+            void setPipelined(bool pipelined);
+
+            /* selects the backend and budget for fitting the skeleton */
+            void setOptimizer(const OptimizerParams& params);
+
+            /* the next three may be changed while pipelined; they apply from
+             * the next frame captured */
+
+            /* restricts per-frame work to the person's surroundings (default on) */
+            void setRegionTracking(bool enabled);
+
+            /* fits against the edge pixels bucketed in Human::edgePoints
+             * instead of distance transforms of the edge map (default off).
+             * saves the per-frame transforms, which grow with the region,
+             * for lookups per cost evaluation, which grow with the outline */
+            void setEdgePoints(bool enabled);
+
+            /* fits coarse-to-fine over this many pyramid levels, widest
+             * radius first (default 1, full resolution only). every level gets
+             * the optimizer's minimum budget (see minimumEvaluations), and the
+             * rest of its budget is split among them, most to the finest; a
+             * budget too small for every level's minimum is exceeded */
+            void setPyramidLevels(int levels);
+
+            /* reseeds the optimizer's generator, for reproducible runs */
+            void seed(uint64_t seed);
+
+            /* batched optimizers evaluate candidates on this pool; NULL is serial */
+            void setThreadPool(ThreadPool* pool);
+
+            void setVisualizationSink(VisualizationSink sink);
+
+            /* arena buffers allocated so far; constant once frames are steady.
+             * safe to call while pipelined. test/allocations.cpp counts every
+             * allocation of a step */
+            uint64_t allocations() const;
+
+            /* latency of each stage since construction or the last reset */
+            StageStats stats(Stage stage) const;
+            void resetStats();
+
+            /* samples hardware counters around each stage, where the system
+             * allows; returns whether it does (default off). the optimize
+             * stage includes its evaluations on the thread pool's helpers.
+             * a thread waiting for its helpers runs other queued tasks
+             * meanwhile, and those are counted in its stage too */
+            bool setPerfCounters(bool enabled);
+            StagePerf perf(Stage stage) const;
+
+            /* the individual stages, public so they can be benchmarked alone;
+             * each updates the context's state as it does within a step */
+            void segment(cv::Mat frame, cv::Mat previous, cv::Rect roi, MatArena& arena,
+                         cv::Mat& foreground, cv::Mat& skin, cv::Mat& motion);
+            cv::Mat edges(cv::Mat foreground, cv::Mat skin, MatArena& arena);
+            void track2DFeatures(cv::Mat skin, cv::Rect roi, cv::Size frame, MatArena& arena);
+
+        private:
+            FrameSource* m_source;
+            std::unique_ptr<FrameSource> m_ownedSource;
+
+            bool capture(FrameSlot& slot);
+            void analyze(FrameSlot& slot, int index);
+            void learnBackground(const cv::Mat& frame);
+            Pose fit(FrameSlot& slot);
+            Pose currentPose() const;
+
+            FrameSlot m_slots[PIPELINE_DEPTH];
+            SPSCQueue<int, 4> m_free, m_captured;
+            bool m_pipelined;
+            std::atomic<bool> m_capturing;
+            std::thread m_captureThread;
+            void captureLoop();
+
+            /* background model: integer and fractional planes */
+            cv::Mat m_background, m_backgroundFraction;
+
+            /* captured frames, reused in turn; slots and the motion cue
+             * refer to them without copying */
+            cv::Mat m_frames[FRAME_RING];
+            bool m_borrowed[FRAME_RING]; /* refers to a frame passed to process() */
+            int m_frameIndex;
+
+            /* settings read by the capture thread, once per frame */
+            std::atomic<bool> m_trackRegion, m_edgePoints;
+            std::atomic<int> m_levels;
+
+            cv::Rect m_roi;
+            int m_roiAge;
 
             Features2D m_last2D, m_lastu2D;
-            void track2DFeatures(cv::Mat skin);
+            bool m_found[BODY_PARTS];
+            cv::Mat m_blobLabels;
+            BlobStats m_blobs;
+            std::vector<cv::Point> m_outline; /* of a hand's blob, reused */
 
             UpperBodySkeleton m_skeleton;
+            OptimizerParams m_optimizer;
+            Random m_random;
+            ThreadPool* m_pool;
+
+            VisualizationSink m_sink;
+
+            StageRecorder m_stats;
+    };
+
+    /**
+     * owns a set of contexts, one per camera stream, and steps them on a
+     * shared ThreadPool. a stream's frames are processed in order; streams
+     * run concurrently. the pool also serves the contexts' batched optimizers
+     */
+
+    class StreamPool {
+        public:
+            typedef std::function<void(int, const Pose&)> PoseSink;
+
+            struct Throughput {
+                uint64_t frames; /* steps completed across all streams */
+                double seconds; /* since start(), until the last stream retired */
+                double fps; /* aggregate frames per second */
+                std::vector<uint64_t> streamFrames;
+            };
+
+            explicit StreamPool(ThreadPool& pool);
+            ~StreamPool();
+
+            /* adds a stream, returning its index; only while stopped */
+            int add(cv::VideoCapture& camera, uint64_t seed = 1);
+            int add(FrameSource& source, uint64_t seed = 1);
+            Context& context(int stream);
+            int size() const;
+
+            /* called from a worker with each stream's poses, in frame order;
+             * a stream whose source runs dry is retired without a call */
+            void setPoseSink(PoseSink sink);
+
+            void start();
+
+            /* stops scheduling and waits for in-flight steps to finish */
+            void stop();
+
+            Throughput throughput() const;
+
+        private:
+            struct Stream {
+                Stream(cv::VideoCapture& camera, uint64_t seed) :
+                                    context(camera, seed),
+                                    frames(0) {}
+
+                Stream(FrameSource& source, uint64_t seed) :
+                                    context(source, seed),
+                                    frames(0) {}
+
+                Context context;
+                std::atomic<uint64_t> frames;
+            };
+
+            void schedule(int stream);
+            void retire();
+            int adopt(Stream* stream);
+
+            ThreadPool& m_pool;
+            std::vector<std::unique_ptr<Stream> > m_streams;
+            PoseSink m_sink;
+
+            std::atomic<bool> m_running;
+            int m_inFlight; /* streams still stepping */
+            mutable std::mutex m_lock;
+            std::condition_variable m_idle;
+
+            std::atomic<uint64_t> m_frames;
+            std::chrono::steady_clock::time_point m_started, m_ended;
     };
 }
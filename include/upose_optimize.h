@@ -0,0 +1,661 @@
+/**
+ * upose_optimize.h
+ * derivative-free optimizers for fitting skeletons
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ *
+ * every backend minimizes an integer cost over an N-dimensional integer
+ * vector. the cost is any functor or lambda callable as int(const int*);
+ * it is a template parameter so the compiler can inline it into the search
+ * loop. all state lives on the stack. the budget is counted in cost
+ * evaluations (excluding the one for the initial guess), so backends can be
+ * compared at equal work.
+ */
+
+#ifndef UPOSE_OPTIMIZE_H
+#define UPOSE_OPTIMIZE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+namespace upose {
+    enum Optimizer {
+        OPTIMIZER_COORDINATE_DESCENT = 0,
+        OPTIMIZER_NELDER_MEAD,
+        OPTIMIZER_CMA_ES,
+        OPTIMIZER_PARTICLE_SWARM,
+        OPTIMIZER_BATCH_SEARCH
+    };
+
+    enum {
+        MAX_BATCH = 64, /* most candidates OPTIMIZER_BATCH_SEARCH draws per round */
+        SWARM_PARTICLES = 8 /* particles of OPTIMIZER_PARTICLE_SWARM */
+    };
+
+    struct OptimizerParams {
+        OptimizerParams(Optimizer _method = OPTIMIZER_COORDINATE_DESCENT,
+                        int _evaluations = 25,
+                        int _radius = 50,
+                        int _batch = 16) :
+                                    method(_method),
+                                    evaluations(_evaluations),
+                                    radius(_radius),
+                                    batch(_batch) {}
+
+        Optimizer method;
+        int evaluations; /* budget of cost function evaluations */
+        int radius; /* initial search radius around the guess */
+        int batch; /* candidates per round for OPTIMIZER_BATCH_SEARCH */
+    };
+
+    /**
+     * xoshiro256** generator (Blackman and Vigna), seeded through splitmix64
+     * each Context owns one, so concurrent contexts never share state and a
+     * given seed reproduces a run exactly
+     */
+
+    class Random {
+        public:
+            explicit Random(uint64_t seed = 1) {
+                this->seed(seed);
+            }
+
+            void seed(uint64_t seed) {
+                for(int i = 0; i < 4; ++i) {
+                    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+                    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                    m_state[i] = z ^ (z >> 31);
+                }
+            }
+
+            uint64_t next() {
+                uint64_t result = rotl(m_state[1] * 5, 7) * 9,
+                         t = m_state[1] << 17;
+
+                m_state[2] ^= m_state[0];
+                m_state[3] ^= m_state[1];
+                m_state[1] ^= m_state[2];
+                m_state[0] ^= m_state[3];
+                m_state[2] ^= t;
+                m_state[3] = rotl(m_state[3], 45);
+
+                return result;
+            }
+
+            /* uniform in [0, 1), from the top 53 bits */
+            double uniform() {
+                return (next() >> 11) * (1.0 / 9007199254740992.0);
+            }
+
+            /* standard normal, by Box-Muller; 1 - u keeps the logarithm finite */
+            double normal() {
+                double u = 1.0 - uniform(), v = uniform();
+                return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+            }
+
+        private:
+            static uint64_t rotl(uint64_t x, int k) {
+                return (x << k) | (x >> (64 - k));
+            }
+
+            uint64_t m_state[4];
+    };
+
+    /**
+     * wraps the cost function: rounds continuous candidates to the integer
+     * lattice, charges the budget, and remembers the best point seen, so each
+     * backend only has to propose candidates
+     */
+
+    template<int N, typename Cost>
+    struct CostTracker {
+        CostTracker(const Cost& _cost, int budget, int* _optimum) :
+                                    cost(_cost),
+                                    remaining(budget),
+                                    best(_cost(_optimum)),
+                                    optimum(_optimum) {}
+
+        int operator()(const double* x) {
+            int candidate[N];
+
+            for(int i = 0; i < N; ++i) {
+                candidate[i] = (int) lround(x[i]);
+            }
+
+            int c = cost(candidate);
+            record(candidate, c);
+
+            return c;
+        }
+
+        /* charges an evaluation made outside the tracker */
+        void record(const int* candidate, int c) {
+            --remaining;
+
+            if(c < best) {
+                best = c;
+                memcpy(optimum, candidate, sizeof(int) * N);
+            }
+        }
+
+        const Cost& cost;
+        int remaining, best;
+        int* optimum;
+    };
+
+    /**
+     * coordinate descent with a shrinking step: probe both directions along
+     * each axis in turn, keep any improvement, and halve the step once a full
+     * sweep fails. deterministic; stops early once the step drops below a pixel
+     */
+
+    template<int N, typename Cost>
+    void optimizeCoordinateDescent(CostTracker<N, Cost>& f, double step) {
+        double x[N];
+        for(int i = 0; i < N; ++i) x[i] = f.optimum[i];
+
+        int fx = f.best;
+
+        while(f.remaining > 0 && step >= 1) {
+            bool improved = false;
+
+            for(int d = 0; d < N && f.remaining > 0; ++d) {
+                for(int sign = -1; sign <= 1 && f.remaining > 0; sign += 2) {
+                    double old = x[d];
+                    x[d] = old + sign * step;
+
+                    int cost = f(x);
+
+                    if(cost < fx) {
+                        fx = cost;
+                        improved = true;
+                        break;
+                    }
+
+                    x[d] = old;
+                }
+            }
+
+            if(!improved) step /= 2;
+        }
+    }
+
+    /**
+     * Nelder-Mead downhill simplex with the standard coefficients
+     * (reflection 1, expansion 2, contraction 1/2, shrink 1/2)
+     */
+
+    template<int N, typename Cost>
+    void optimizeNelderMead(CostTracker<N, Cost>& f, double radius) {
+        double v[N + 1][N];
+        int fv[N + 1];
+
+        /* initial simplex: the guess plus a step along each axis */
+        for(int i = 0; i <= N; ++i) {
+            for(int d = 0; d < N; ++d) v[i][d] = f.optimum[d];
+        }
+
+        fv[0] = f.best;
+
+        for(int i = 1; i <= N && f.remaining > 0; ++i) {
+            v[i][i - 1] += radius;
+            fv[i] = f(v[i]);
+        }
+
+        while(f.remaining > 0) {
+            /* order vertices best to worst */
+            for(int i = 1; i <= N; ++i) {
+                for(int j = i; j > 0 && fv[j] < fv[j - 1]; --j) {
+                    std::swap(fv[j], fv[j - 1]);
+                    std::swap_ranges(v[j], v[j] + N, v[j - 1]);
+                }
+            }
+
+            /* stop once the simplex has collapsed onto a single pixel */
+            double extent = 0;
+
+            for(int i = 1; i <= N; ++i) {
+                for(int d = 0; d < N; ++d) {
+                    extent = std::max(extent, std::fabs(v[i][d] - v[0][d]));
+                }
+            }
+
+            if(extent < 0.5) break;
+
+            double c[N], xr[N], xt[N];
+
+            for(int d = 0; d < N; ++d) {
+                c[d] = 0;
+                for(int i = 0; i < N; ++i) c[d] += v[i][d];
+                c[d] /= N;
+
+                xr[d] = c[d] + (c[d] - v[N][d]);
+            }
+
+            int fr = f(xr);
+
+            if(fr < fv[0] && f.remaining > 0) {
+                /* expand */
+                for(int d = 0; d < N; ++d) xt[d] = c[d] + 2 * (c[d] - v[N][d]);
+                int fe = f(xt);
+
+                if(fe < fr) {
+                    memcpy(v[N], xt, sizeof(xt));
+                    fv[N] = fe;
+                } else {
+                    memcpy(v[N], xr, sizeof(xr));
+                    fv[N] = fr;
+                }
+            } else if(fr < fv[N - 1]) {
+                memcpy(v[N], xr, sizeof(xr));
+                fv[N] = fr;
+            } else if(f.remaining > 0) {
+                /* contract, outside or inside the simplex */
+                bool outside = fr < fv[N];
+
+                for(int d = 0; d < N; ++d) {
+                    xt[d] = c[d] + 0.5 * ((outside ? xr[d] : v[N][d]) - c[d]);
+                }
+
+                int fc = f(xt);
+
+                if(fc < std::min(fr, fv[N])) {
+                    memcpy(v[N], xt, sizeof(xt));
+                    fv[N] = fc;
+                } else {
+                    /* shrink toward the best vertex */
+                    for(int i = 1; i <= N && f.remaining > 0; ++i) {
+                        for(int d = 0; d < N; ++d) v[i][d] = v[0][d] + 0.5 * (v[i][d] - v[0][d]);
+                        fv[i] = f(v[i]);
+                    }
+                }
+            }
+        }
+    }
+
+    /* cyclic Jacobi eigendecomposition of a symmetric matrix: a = b diag(d) b^T */
+
+    template<int N>
+    void symmetricEigen(const double a[N][N], double b[N][N], double d[N]) {
+        double m[N][N];
+        memcpy(m, a, sizeof(m));
+
+        for(int i = 0; i < N; ++i) {
+            for(int j = 0; j < N; ++j) b[i][j] = (i == j);
+        }
+
+        for(int sweep = 0; sweep < 32; ++sweep) {
+            double off = 0;
+
+            for(int p = 0; p < N; ++p) {
+                for(int q = p + 1; q < N; ++q) off += m[p][q] * m[p][q];
+            }
+
+            if(off < 1e-18) break;
+
+            for(int p = 0; p < N; ++p) {
+                for(int q = p + 1; q < N; ++q) {
+                    if(std::fabs(m[p][q]) < 1e-300) continue;
+
+                    double theta = (m[q][q] - m[p][p]) / (2 * m[p][q]);
+                    double t = (theta >= 0 ? 1 : -1) / (std::fabs(theta) + sqrt(theta*theta + 1));
+                    double c = 1 / sqrt(t*t + 1), s = t * c;
+
+                    for(int k = 0; k < N; ++k) {
+                        double mkp = m[k][p], mkq = m[k][q];
+                        m[k][p] = c*mkp - s*mkq;
+                        m[k][q] = s*mkp + c*mkq;
+                    }
+
+                    for(int k = 0; k < N; ++k) {
+                        double mpk = m[p][k], mqk = m[q][k];
+                        m[p][k] = c*mpk - s*mqk;
+                        m[q][k] = s*mpk + c*mqk;
+                    }
+
+                    for(int k = 0; k < N; ++k) {
+                        double bkp = b[k][p], bkq = b[k][q];
+                        b[k][p] = c*bkp - s*bkq;
+                        b[k][q] = s*bkp + c*bkq;
+                    }
+                }
+            }
+        }
+
+        for(int i = 0; i < N; ++i) d[i] = m[i][i];
+    }
+
+    /**
+     * CMA-ES (covariance matrix adaptation evolution strategy), following
+     * Hansen's "The CMA Evolution Strategy: A Tutorial" with default parameters
+     * the initial step size is half the search radius
+     */
+
+    /* candidates per CMA-ES generation, Hansen's default */
+    template<int N>
+    int populationCMAES() {
+        return 4 + (int) (3 * log((double) N));
+    }
+
+    template<int N, typename Cost>
+    void optimizeCMAES(CostTracker<N, Cost>& f, double radius, Random& rng) {
+        const int lambda = populationCMAES<N>(), mu = lambda / 2;
+        const int maxLambda = 4 + 3 * N; /* bounds lambda, since log N < N */
+
+        double w[maxLambda], wsum = 0, w2sum = 0;
+
+        for(int i = 0; i < mu; ++i) {
+            w[i] = log(mu + 0.5) - log(i + 1.0);
+            wsum += w[i];
+        }
+
+        for(int i = 0; i < mu; ++i) {
+            w[i] /= wsum;
+            w2sum += w[i] * w[i];
+        }
+
+        const double mueff = 1 / w2sum,
+                     cc = (4 + mueff / N) / (N + 4 + 2 * mueff / N),
+                     cs = (mueff + 2) / (N + mueff + 5),
+                     c1 = 2 / ((N + 1.3) * (N + 1.3) + mueff),
+                     cmu = std::min(1 - c1, 2 * (mueff - 2 + 1 / mueff) / ((N + 2) * (N + 2) + mueff)),
+                     damps = 1 + 2 * std::max(0.0, sqrt((mueff - 1) / (N + 1)) - 1) + cs,
+                     chiN = sqrt((double) N) * (1 - 1.0 / (4 * N) + 1.0 / (21 * N * N));
+
+        double mean[N], pc[N], ps[N], C[N][N], B[N][N], D[N];
+        double sigma = radius / 2;
+
+        for(int i = 0; i < N; ++i) {
+            mean[i] = f.optimum[i];
+            pc[i] = ps[i] = 0;
+            D[i] = 1;
+
+            for(int j = 0; j < N; ++j) C[i][j] = B[i][j] = (i == j);
+        }
+
+        double x[maxLambda][N], y[maxLambda][N];
+        int fx[maxLambda], order[maxLambda];
+
+        for(int generation = 1; f.remaining >= lambda; ++generation) {
+            /* sample: y = B D z, x = mean + sigma y */
+            for(int k = 0; k < lambda; ++k) {
+                double z[N];
+                for(int i = 0; i < N; ++i) z[i] = D[i] * rng.normal();
+
+                for(int i = 0; i < N; ++i) {
+                    y[k][i] = 0;
+                    for(int j = 0; j < N; ++j) y[k][i] += B[i][j] * z[j];
+
+                    x[k][i] = mean[i] + sigma * y[k][i];
+                }
+
+                fx[k] = f(x[k]);
+                order[k] = k;
+            }
+
+            std::sort(order, order + lambda, [&fx](int a, int b) { return fx[a] < fx[b]; });
+
+            /* recombine the mu best steps */
+            double yw[N];
+
+            for(int i = 0; i < N; ++i) {
+                yw[i] = 0;
+                for(int k = 0; k < mu; ++k) yw[i] += w[k] * y[order[k]][i];
+
+                mean[i] += sigma * yw[i];
+            }
+
+            /* C^-1/2 yw = B D^-1 B^T yw */
+            double t[N], invsqrt[N];
+
+            for(int j = 0; j < N; ++j) {
+                t[j] = 0;
+                for(int i = 0; i < N; ++i) t[j] += B[i][j] * yw[i];
+                t[j] /= D[j];
+            }
+
+            for(int i = 0; i < N; ++i) {
+                invsqrt[i] = 0;
+                for(int j = 0; j < N; ++j) invsqrt[i] += B[i][j] * t[j];
+            }
+
+            double psnorm = 0;
+
+            for(int i = 0; i < N; ++i) {
+                ps[i] = (1 - cs) * ps[i] + sqrt(cs * (2 - cs) * mueff) * invsqrt[i];
+                psnorm += ps[i] * ps[i];
+            }
+
+            psnorm = sqrt(psnorm);
+
+            bool hsig = psnorm / sqrt(1 - pow(1 - cs, 2.0 * generation)) / chiN < 1.4 + 2.0 / (N + 1);
+
+            for(int i = 0; i < N; ++i) {
+                pc[i] = (1 - cc) * pc[i] + (hsig ? sqrt(cc * (2 - cc) * mueff) : 0) * yw[i];
+            }
+
+            /* rank-one and rank-mu covariance updates */
+            for(int i = 0; i < N; ++i) {
+                for(int j = 0; j < N; ++j) {
+                    double rankMu = 0;
+                    for(int k = 0; k < mu; ++k) rankMu += w[k] * y[order[k]][i] * y[order[k]][j];
+
+                    C[i][j] = (1 - c1 - cmu) * C[i][j]
+                            + c1 * (pc[i] * pc[j] + (hsig ? 0 : cc * (2 - cc) * C[i][j]))
+                            + cmu * rankMu;
+                }
+            }
+
+            sigma *= exp((cs / damps) * (psnorm / chiN - 1));
+
+            symmetricEigen<N>(C, B, D);
+
+            for(int i = 0; i < N; ++i) D[i] = sqrt(std::max(D[i], 1e-20));
+
+            /* converged below pixel resolution */
+            if(sigma * *std::max_element(D, D + N) < 0.25) break;
+        }
+    }
+
+    /**
+     * particle swarm optimization with a constant inertia weight;
+     * particles start uniformly within the search radius of the guess
+     */
+
+    template<int N, typename Cost>
+    void optimizeParticleSwarm(CostTracker<N, Cost>& f, double radius, Random& rng) {
+        const int particles = SWARM_PARTICLES;
+        const double inertia = 0.7, cognitive = 1.5, social = 1.5;
+
+        double x[particles][N], v[particles][N], best[particles][N], global[N];
+        int bestCost[particles], globalCost = f.best;
+
+        for(int d = 0; d < N; ++d) global[d] = f.optimum[d];
+
+        for(int p = 0; p < particles; ++p) {
+            for(int d = 0; d < N; ++d) {
+                /* particle 0 starts on the guess itself */
+                x[p][d] = global[d] + (p ? (2 * rng.uniform() - 1) * radius : 0);
+                v[p][d] = (2 * rng.uniform() - 1) * radius / 2;
+            }
+
+            memcpy(best[p], x[p], sizeof(x[p]));
+            bestCost[p] = p ? f(x[p]) : f.best;
+
+            if(bestCost[p] < globalCost) {
+                globalCost = bestCost[p];
+                memcpy(global, x[p], sizeof(global));
+            }
+
+            if(f.remaining <= 0) return;
+        }
+
+        while(f.remaining > 0) {
+            for(int p = 0; p < particles && f.remaining > 0; ++p) {
+                for(int d = 0; d < N; ++d) {
+                    v[p][d] = inertia * v[p][d]
+                            + cognitive * rng.uniform() * (best[p][d] - x[p][d])
+                            + social * rng.uniform() * (global[d] - x[p][d]);
+
+                    v[p][d] = std::max(-radius, std::min(radius, v[p][d]));
+                    x[p][d] += v[p][d];
+                }
+
+                int cost = f(x[p]);
+
+                if(cost < bestCost[p]) {
+                    bestCost[p] = cost;
+                    memcpy(best[p], x[p], sizeof(x[p]));
+
+                    if(cost < globalCost) {
+                        globalCost = cost;
+                        memcpy(global, x[p], sizeof(global));
+                    }
+                }
+            }
+        }
+    }
+
+    /* runs body(i) for every i in [0, count) on the calling thread */
+
+    struct SerialFor {
+        template<typename Body>
+        void operator()(int count, const Body& body) const {
+            for(int i = 0; i < count; ++i) body(i);
+        }
+    };
+
+    /**
+     * batched random search: each round draws a batch of candidates from an
+     * isotropic Gaussian around the best point and evaluates them together
+     * through `parallel`, which may fan them out across threads; the cost
+     * must then be safe to call concurrently. the step size grows after a
+     * round that improves and shrinks after one that does not. a round's
+     * body captures two references, so a std::function holding it, as a
+     * thread pool's does, keeps it inline rather than on the heap
+     */
+
+    template<int N, typename Cost, typename Parallel>
+    void optimizeBatchSearch(CostTracker<N, Cost>& f, double radius, int batch,
+                             Random& rng, const Parallel& parallel) {
+        struct {
+            int candidates[MAX_BATCH][N], costs[MAX_BATCH];
+        } round;
+
+        double sigma = radius / 2;
+
+        batch = std::max(1, std::min(batch, (int) MAX_BATCH));
+
+        while(f.remaining > 0 && sigma >= 0.5) {
+            int count = std::min(batch, f.remaining);
+
+            /* draw serially so results do not depend on scheduling */
+            for(int k = 0; k < count; ++k) {
+                for(int d = 0; d < N; ++d) {
+                    round.candidates[k][d] = f.optimum[d] + (int) lround(sigma * rng.normal());
+                }
+            }
+
+            const Cost& cost = f.cost;
+            parallel(count, [&round, &cost](int k) { round.costs[k] = cost(round.candidates[k]); });
+
+            int before = f.best;
+            for(int k = 0; k < count; ++k) f.record(round.candidates[k], round.costs[k]);
+
+            sigma *= f.best < before ? 1.5 : 0.6;
+        }
+    }
+
+    /**
+     * the smallest budget with which a backend gets past its set-up and can
+     * move off the guess: a full coordinate sweep, the initial simplex and a
+     * step, a CMA-ES generation, the swarm and a move, or a batch round.
+     * with less, CMA-ES does nothing at all
+     */
+
+    template<int N>
+    int minimumEvaluations(const OptimizerParams& params) {
+        switch(params.method) {
+            case OPTIMIZER_NELDER_MEAD:
+                return N + 2;
+
+            case OPTIMIZER_CMA_ES:
+                return populationCMAES<N>();
+
+            case OPTIMIZER_PARTICLE_SWARM:
+                return SWARM_PARTICLES + 1;
+
+            case OPTIMIZER_BATCH_SEARCH:
+                return std::max(1, std::min(params.batch, (int) MAX_BATCH));
+
+            case OPTIMIZER_COORDINATE_DESCENT:
+            default:
+                return 2 * N;
+        }
+    }
+
+    /**
+     * the parameters for one level of a coarse-to-fine fit over levels
+     * levels, 0 being the finest. each level halves the radius of the one
+     * above. every level gets the backend's minimum, or it would not move at
+     * all, and the rest of the budget goes mostly to the finest level, which
+     * sets the final accuracy: level l gets 2^(levels-1-l) shares of it.
+     * a single level keeps params as they are
+     */
+
+    template<int N>
+    OptimizerParams levelParams(const OptimizerParams& params, int levels, int level) {
+        int least = levels > 1 ? minimumEvaluations<N>(params) : 0,
+            spare = std::max(0, params.evaluations - least * levels),
+            shares = (1 << levels) - 1;
+
+        OptimizerParams p = params;
+        p.radius = std::max(1, params.radius >> (levels - 1 - level));
+        p.evaluations = std::max(1, least + (spare << (levels - 1 - level)) / shares);
+
+        return p;
+    }
+
+    /**
+     * minimizes cost over N integers with the backend selected in params
+     * on entry, optimum is the initial guess; on exit, the best point found
+     * stochastic backends draw only from rng. batched backends hand candidate
+     * evaluations to parallel(count, body). returns the cost at the optimum
+     */
+
+    template<int N, typename Cost, typename Parallel = SerialFor>
+    int optimize(const OptimizerParams& params, const Cost& cost, int* optimum,
+                 Random& rng, const Parallel& parallel = Parallel()) {
+        CostTracker<N, Cost> f(cost, params.evaluations, optimum);
+
+        switch(params.method) {
+            case OPTIMIZER_COORDINATE_DESCENT:
+                optimizeCoordinateDescent<N>(f, params.radius);
+                break;
+
+            case OPTIMIZER_NELDER_MEAD:
+                optimizeNelderMead<N>(f, params.radius);
+                break;
+
+            case OPTIMIZER_CMA_ES:
+                optimizeCMAES<N>(f, params.radius, rng);
+                break;
+
+            case OPTIMIZER_PARTICLE_SWARM:
+                optimizeParticleSwarm<N>(f, params.radius, rng);
+                break;
+
+            case OPTIMIZER_BATCH_SEARCH:
+                optimizeBatchSearch<N>(f, params.radius, params.batch, rng, parallel);
+                break;
+        }
+
+        return f.best;
+    }
+}
+
+#endif
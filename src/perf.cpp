@@ -0,0 +1,103 @@
+/**
+ * perf.cpp
+ * hardware performance counters for uPose, via Linux perf events
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#include <upose.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace upose {
+#if defined(__linux__)
+    namespace {
+        /**
+         * one group per thread, led by the cycle counter, so all events are
+         * scheduled together and read with a single read(). events the CPU
+         * or hypervisor refuses are left out of the group and read as zero
+         */
+
+        class PerfGroup {
+            public:
+                PerfGroup() : m_leader(-1), m_count(0) {
+                    const uint64_t events[] = {
+                        PERF_COUNT_HW_CPU_CYCLES,
+                        PERF_COUNT_HW_INSTRUCTIONS,
+                        PERF_COUNT_HW_CACHE_MISSES,
+                        PERF_COUNT_HW_BRANCH_MISSES
+                    };
+
+                    for(unsigned int i = 0; i < countof(events); ++i) {
+                        struct perf_event_attr attr;
+                        memset(&attr, 0, sizeof(attr));
+
+                        attr.size = sizeof(attr);
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = events[i];
+                        attr.read_format = PERF_FORMAT_GROUP;
+                        attr.exclude_kernel = 1;
+                        attr.exclude_hv = 1;
+
+                        /* this thread, any CPU */
+                        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, m_leader, 0);
+
+                        if(fd < 0) {
+                            /* without cycles there is no group to join */
+                            if(i == 0) return;
+                            continue;
+                        }
+
+                        if(i == 0) m_leader = fd;
+                        else m_fds[m_count - 1] = fd;
+
+                        m_slots[m_count++] = i;
+                    }
+                }
+
+                ~PerfGroup() {
+                    for(int i = 1; i < m_count; ++i) close(m_fds[i - 1]);
+                    if(m_leader >= 0) close(m_leader);
+                }
+
+                bool read(PerfSample& sample) {
+                    if(m_leader < 0) return false;
+
+                    /* the group format: the number of events, then each value */
+                    uint64_t values[1 + 4];
+                    ssize_t expected = (1 + m_count) * sizeof(uint64_t);
+
+                    if(::read(m_leader, values, sizeof(values)) != expected) return false;
+
+                    uint64_t counts[4] = { 0, 0, 0, 0 };
+                    for(int i = 0; i < m_count; ++i) counts[m_slots[i]] = values[1 + i];
+
+                    sample.cycles = counts[0];
+                    sample.instructions = counts[1];
+                    sample.cacheMisses = counts[2];
+                    sample.branchMisses = counts[3];
+
+                    return true;
+                }
+
+            private:
+                int m_leader, m_fds[3];
+                int m_count, m_slots[4];
+        };
+    }
+
+    bool readPerfCounters(PerfSample& sample) {
+        static thread_local PerfGroup group;
+        return group.read(sample);
+    }
+#else
+    bool readPerfCounters(PerfSample&) {
+        return false;
+    }
+#endif
+}
@@ -0,0 +1,392 @@
+/**
+ * segment.cpp
+ * fused per-pixel segmentation kernels for uPose
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <upose.h>
+
+/**
+ * the vector kernels are compiled for their instruction set function by
+ * function, whatever the flags of the build, and picked at run time from
+ * what the CPU supports, so one library runs everywhere at its best
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UPOSE_X86 1
+#define UPOSE_SSSE3 __attribute__((target("ssse3")))
+#define UPOSE_AVX2 __attribute__((target("avx2")))
+
+#include <immintrin.h>
+#endif
+
+namespace upose {
+    /**
+     * the per-pixel tests, for one BGR pixel f against background pixel bg
+     *
+     * foreground: some channel is darker than the background by more than a
+     * quarter of its value. this is the old saturating m_background - frame >
+     * 0.25*frame, including OpenCV's round-half-to-even of f/4
+     *
+     * skin: I = 0.6R - 0.3G - 0.3B of YIQ lies in (1, 16), as in Brand and
+     * Mason 2000. like the old cv::Mat expression, 0.6R - 0.3G is rounded and
+     * clamped at zero before 0.3B is subtracted. the test runs in exact
+     * integer arithmetic on tenths, so it vectorizes on 16-bit lanes; it can
+     * differ from the float expression only where I is exactly half-way
+     * between integers, which float rounding error decides arbitrarily anyway
+     */
+
+    inline bool foregroundPixel(const uchar* f, const uchar* bg) {
+        bool foreground = false;
+
+        for(int c = 0; c < 3; ++c) {
+            int quarter = (f[c] + 1 + ((f[c] >> 2) & 1)) >> 2;
+            foreground |= bg[c] - f[c] > quarter;
+        }
+
+        return foreground;
+    }
+
+    /* motion energy: the largest per-channel change since the previous frame */
+
+    inline uchar motionPixel(const uchar* f, const uchar* prev) {
+        int energy = 0;
+
+        for(int c = 0; c < 3; ++c) {
+            energy = std::max(energy, std::abs(f[c] - prev[c]));
+        }
+
+        return energy;
+    }
+
+    inline bool skinPixel(const uchar* f) {
+        int partial = std::max(0, (6*f[2] - 3*f[1] + 5) / 10);
+        int tenths = 10*partial - 3*f[0];
+
+        /* I rounds to 2..15 */
+        return tenths >= 15 && tenths < 155;
+    }
+
+#if defined(UPOSE_X86)
+    /* splits 16 packed BGR pixels into one register per channel */
+
+    UPOSE_SSSE3 static inline void deinterleave(const uchar* p, __m128i& b, __m128i& g, __m128i& r) {
+        __m128i a = _mm_loadu_si128((const __m128i*) p),
+                m = _mm_loadu_si128((const __m128i*) (p + 16)),
+                c = _mm_loadu_si128((const __m128i*) (p + 32));
+
+        b = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1))),
+                _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13)));
+
+        g = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(a, _mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1))),
+                _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14)));
+
+        r = _mm_or_si128(_mm_or_si128(
+                _mm_shuffle_epi8(a, _mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                _mm_shuffle_epi8(m, _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1))),
+                _mm_shuffle_epi8(c, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15)));
+    }
+
+    /* bytes where bg - f > round(f / 4), as 0xFF */
+
+    UPOSE_SSSE3 static inline __m128i darker(__m128i f, __m128i bg) {
+        /* round half to even: ((f + odd + 1) >> 1) >> 1, with odd = bit 2 of f */
+        __m128i odd = _mm_and_si128(_mm_srli_epi16(f, 2), _mm_set1_epi8(1)),
+                quarter = _mm_and_si128(_mm_srli_epi16(_mm_avg_epu8(f, odd), 1), _mm_set1_epi8(0x7F));
+
+        return _mm_subs_epu8(_mm_subs_epu8(bg, f), quarter);
+    }
+
+    /* |a - b| per byte */
+
+    UPOSE_SSSE3 static inline __m128i absDiff(__m128i a, __m128i b) {
+        return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    }
+
+    /* the skin test on 8 pixels widened to 16 bits, as 0xFFFF words */
+
+    UPOSE_SSSE3 static inline __m128i skinHalf(__m128i b16, __m128i g16, __m128i r16) {
+        __m128i p = _mm_add_epi16(_mm_sub_epi16(_mm_mullo_epi16(r16, _mm_set1_epi16(6)),
+                                                _mm_mullo_epi16(g16, _mm_set1_epi16(3))),
+                                  _mm_set1_epi16(5));
+
+        __m128i partial = _mm_max_epi16(_mm_mulhi_epi16(p, _mm_set1_epi16(6554)), _mm_setzero_si128());
+        __m128i tenths = _mm_sub_epi16(_mm_mullo_epi16(partial, _mm_set1_epi16(10)),
+                                       _mm_mullo_epi16(b16, _mm_set1_epi16(3)));
+
+        return _mm_andnot_si128(_mm_cmpgt_epi16(tenths, _mm_set1_epi16(154)),
+                                _mm_cmpgt_epi16(tenths, _mm_set1_epi16(14)));
+    }
+
+    /**
+     * skin test for 16 pixels as 0xFF bytes, in the fixed point of skinPixel
+     * (p + 5) / 10 is a multiply-high by 6554, exact for the range of p
+     */
+
+    UPOSE_SSSE3 static inline __m128i skinMaskSSSE3(__m128i b, __m128i g, __m128i r) {
+        __m128i zero = _mm_setzero_si128();
+
+        return _mm_packs_epi16(
+                skinHalf(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(r, zero)),
+                skinHalf(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(r, zero)));
+    }
+
+    /* the same, all 16 pixels in one AVX2 register */
+
+    UPOSE_AVX2 static inline __m128i skinMaskAVX2(__m128i b, __m128i g, __m128i r) {
+        __m256i b16 = _mm256_cvtepu8_epi16(b),
+                g16 = _mm256_cvtepu8_epi16(g),
+                r16 = _mm256_cvtepu8_epi16(r);
+
+        __m256i p = _mm256_add_epi16(_mm256_sub_epi16(_mm256_mullo_epi16(r16, _mm256_set1_epi16(6)),
+                                                      _mm256_mullo_epi16(g16, _mm256_set1_epi16(3))),
+                                     _mm256_set1_epi16(5));
+
+        __m256i partial = _mm256_max_epi16(_mm256_mulhi_epi16(p, _mm256_set1_epi16(6554)), _mm256_setzero_si256());
+        __m256i tenths = _mm256_sub_epi16(_mm256_mullo_epi16(partial, _mm256_set1_epi16(10)),
+                                          _mm256_mullo_epi16(b16, _mm256_set1_epi16(3)));
+
+        __m256i mask = _mm256_andnot_si256(_mm256_cmpgt_epi16(tenths, _mm256_set1_epi16(154)),
+                                           _mm256_cmpgt_epi16(tenths, _mm256_set1_epi16(14)));
+
+        return _mm_packs_epi16(_mm256_castsi256_si128(mask), _mm256_extracti128_si256(mask, 1));
+    }
+
+    /* the foreground and motion outputs of 16 pixels, whose channels are b, g, r */
+
+    UPOSE_SSSE3 static inline void foregroundAndMotion(const uchar* bg, const uchar* prev,
+                                                       uchar* fgOut, uchar* motionOut,
+                                                       __m128i b, __m128i g, __m128i r) {
+        __m128i bb, bgg, br;
+        deinterleave(bg, bb, bgg, br);
+
+        __m128i any = _mm_or_si128(_mm_or_si128(darker(b, bb), darker(g, bgg)), darker(r, br));
+        __m128i fgMask = _mm_xor_si128(_mm_cmpeq_epi8(any, _mm_setzero_si128()), _mm_set1_epi8(-1));
+
+        _mm_storeu_si128((__m128i*) fgOut, fgMask);
+
+        __m128i energy = _mm_setzero_si128();
+
+        if(prev) {
+            __m128i pb, pg, pr;
+            deinterleave(prev, pb, pg, pr);
+
+            energy = _mm_max_epu8(_mm_max_epu8(absDiff(b, pb), absDiff(g, pg)), absDiff(r, pr));
+        }
+
+        _mm_storeu_si128((__m128i*) motionOut, energy);
+    }
+#endif
+
+    /**
+     * a row kernel segments the leading pixels of a row 16 at a time and
+     * returns how many it did; the scalar loop finishes the row. prev is
+     * NULL without a previous frame
+     */
+
+    typedef int (*SegmentRow)(const uchar* f, const uchar* bg, const uchar* prev,
+                              uchar* fgOut, uchar* skinOut, uchar* motionOut, int cols);
+
+#if defined(UPOSE_X86)
+    UPOSE_SSSE3 static int segmentRowSSSE3(const uchar* f, const uchar* bg, const uchar* prev,
+                                           uchar* fgOut, uchar* skinOut, uchar* motionOut, int cols) {
+        int x = 0;
+
+        for(; x + 16 <= cols; x += 16) {
+            __m128i b, g, r;
+            deinterleave(f + 3*x, b, g, r);
+
+            _mm_storeu_si128((__m128i*) (skinOut + x), skinMaskSSSE3(b, g, r));
+            foregroundAndMotion(bg + 3*x, prev ? prev + 3*x : NULL, fgOut + x, motionOut + x, b, g, r);
+        }
+
+        return x;
+    }
+
+    UPOSE_AVX2 static int segmentRowAVX2(const uchar* f, const uchar* bg, const uchar* prev,
+                                         uchar* fgOut, uchar* skinOut, uchar* motionOut, int cols) {
+        int x = 0;
+
+        for(; x + 16 <= cols; x += 16) {
+            __m128i b, g, r;
+            deinterleave(f + 3*x, b, g, r);
+
+            _mm_storeu_si128((__m128i*) (skinOut + x), skinMaskAVX2(b, g, r));
+            foregroundAndMotion(bg + 3*x, prev ? prev + 3*x : NULL, fgOut + x, motionOut + x, b, g, r);
+        }
+
+        return x;
+    }
+#endif
+
+    static int segmentRowScalar(const uchar*, const uchar*, const uchar*, uchar*, uchar*, uchar*, int) {
+        return 0;
+    }
+
+    /* the widest kernel the CPU runs */
+
+    static SegmentRow segmentRowKernel() {
+#if defined(UPOSE_X86)
+        __builtin_cpu_init();
+
+        if(__builtin_cpu_supports("avx2")) return segmentRowAVX2;
+        if(__builtin_cpu_supports("ssse3")) return segmentRowSSSE3;
+#endif
+
+        return segmentRowScalar;
+    }
+
+    /**
+     * fused segmentation: reads each pixel of frame and background once and
+     * writes both raw masks (0 or 255), replacing the dozen full-frame passes
+     * of the old abs-diff, compare, cvtColor, split, and YIQ expressions.
+     * 16 pixels at a time where the CPU has SSSE3 (the skin test in one AVX2
+     * register where it has AVX2)
+     *
+     * given the previous frame, the same pass writes the motion energy of
+     * each pixel; the frame is already in registers, so this costs one more
+     * load per 16 pixels. without one, motion is all zero
+     */
+
+    void segmentPixels(const cv::Mat& frame, const cv::Mat& background, const cv::Mat& previous,
+                       cv::Mat& foreground, cv::Mat& skin, cv::Mat& motion) {
+        CV_Assert(frame.type() == CV_8UC3 && background.type() == CV_8UC3
+                  && frame.size() == background.size()
+                  && (previous.empty() || (previous.type() == CV_8UC3 && previous.size() == frame.size())));
+
+        foreground.create(frame.size(), CV_8U);
+        skin.create(frame.size(), CV_8U);
+        motion.create(frame.size(), CV_8U);
+
+        static const SegmentRow segmentRow = segmentRowKernel();
+
+        bool moving = !previous.empty();
+
+        for(int y = 0; y < frame.rows; ++y) {
+            const uchar* f = frame.ptr<uchar>(y);
+            const uchar* bg = background.ptr<uchar>(y);
+            const uchar* prev = moving ? previous.ptr<uchar>(y) : NULL;
+            uchar* fgOut = foreground.ptr<uchar>(y);
+            uchar* skinOut = skin.ptr<uchar>(y);
+            uchar* motionOut = motion.ptr<uchar>(y);
+
+            int x = segmentRow(f, bg, prev, fgOut, skinOut, motionOut, frame.cols);
+
+            for(; x < frame.cols; ++x) {
+                fgOut[x] = foregroundPixel(f + 3*x, bg + 3*x) ? 255 : 0;
+                skinOut[x] = skinPixel(f + 3*x) ? 255 : 0;
+                motionOut[x] = moving ? motionPixel(f + 3*x, prev + 3*x) : 0;
+            }
+        }
+    }
+
+    /**
+     * adaptive background: an exponential running average per channel, kept
+     * in 8.8 fixed point across two 8-bit planes so the integer plane is the
+     * background segmentPixels compares against. background pixels follow the
+     * frame at 1/2^BACKGROUND_RATE per frame; foreground pixels at the much
+     * slower 1/2^FOREGROUND_RATE, so a person standing still is not absorbed
+     * while lighting drift still is. v - v/2^k + t/2^k never overflows 16 bits
+     */
+
+    inline uint16_t blendBackground(uint16_t v, uchar f, int rate) {
+        return v - (v >> rate) + ((f << 8) >> rate);
+    }
+
+#if defined(UPOSE_X86)
+    UPOSE_SSSE3 static inline __m128i blendHalf(__m128i v, __m128i target, __m128i foreground) {
+        __m128i fast = _mm_add_epi16(_mm_sub_epi16(v, _mm_srli_epi16(v, BACKGROUND_RATE)),
+                                     _mm_srli_epi16(target, BACKGROUND_RATE)),
+                slow = _mm_add_epi16(_mm_sub_epi16(v, _mm_srli_epi16(v, FOREGROUND_RATE)),
+                                     _mm_srli_epi16(target, FOREGROUND_RATE));
+
+        return _mm_or_si128(_mm_and_si128(foreground, slow), _mm_andnot_si128(foreground, fast));
+    }
+
+    /* updates 16 interleaved bytes given their per-byte foreground mask */
+
+    UPOSE_SSSE3 static inline void blendBytes(const uchar* f, uchar* hi, uchar* lo, __m128i mask) {
+        __m128i zero = _mm_setzero_si128(),
+                frame = _mm_loadu_si128((const __m128i*) f),
+                high = _mm_loadu_si128((const __m128i*) hi),
+                low = _mm_loadu_si128((const __m128i*) lo);
+
+        __m128i a = blendHalf(_mm_unpacklo_epi8(low, high), _mm_unpacklo_epi8(zero, frame), _mm_unpacklo_epi8(mask, mask)),
+                b = blendHalf(_mm_unpackhi_epi8(low, high), _mm_unpackhi_epi8(zero, frame), _mm_unpackhi_epi8(mask, mask));
+
+        __m128i byte = _mm_set1_epi16(0xFF);
+
+        _mm_storeu_si128((__m128i*) hi, _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+        _mm_storeu_si128((__m128i*) lo, _mm_packus_epi16(_mm_and_si128(a, byte), _mm_and_si128(b, byte)));
+    }
+
+    /* blends the leading pixels of a row 16 at a time, returning how many */
+
+    UPOSE_SSSE3 static int blendRowSSSE3(const uchar* f, const uchar* fg, uchar* hi, uchar* lo, int cols) {
+        int x = 0;
+
+        for(; x + 16 <= cols; x += 16) {
+            /* widen the 16 pixel masks to their 48 channel bytes */
+            __m128i mask = _mm_loadu_si128((const __m128i*) (fg + x));
+            __m128i masks[] = {
+                _mm_shuffle_epi8(mask, _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5)),
+                _mm_shuffle_epi8(mask, _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10)),
+                _mm_shuffle_epi8(mask, _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15))
+            };
+
+            for(int i = 0; i < 3; ++i) {
+                int offset = 3*x + 16*i;
+                blendBytes(f + offset, hi + offset, lo + offset, masks[i]);
+            }
+        }
+
+        return x;
+    }
+#endif
+
+    static bool hasSSSE3() {
+#if defined(UPOSE_X86)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("ssse3");
+#else
+        return false;
+#endif
+    }
+
+    void updateBackground(const cv::Mat& frame, const cv::Mat& foreground,
+                          cv::Mat& background, cv::Mat& fraction) {
+        CV_Assert(frame.type() == CV_8UC3 && foreground.type() == CV_8U
+                  && background.type() == CV_8UC3 && fraction.type() == CV_8UC3
+                  && frame.size() == background.size() && frame.size() == fraction.size());
+
+        static const bool ssse3 = hasSSSE3();
+
+        for(int y = 0; y < frame.rows; ++y) {
+            const uchar* f = frame.ptr<uchar>(y);
+            const uchar* fg = foreground.ptr<uchar>(y);
+            uchar* hi = background.ptr<uchar>(y);
+            uchar* lo = fraction.ptr<uchar>(y);
+
+            int x = ssse3 ? blendRowSSSE3(f, fg, hi, lo, frame.cols) : 0;
+
+            for(; x < frame.cols; ++x) {
+                int rate = fg[x] ? FOREGROUND_RATE : BACKGROUND_RATE;
+
+                for(int c = 3*x; c < 3*x + 3; ++c) {
+                    uint16_t v = blendBackground((hi[c] << 8) | lo[c], f[c], rate);
+
+                    hi[c] = v >> 8;
+                    lo[c] = v & 0xFF;
+                }
+            }
+        }
+    }
+}
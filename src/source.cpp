@@ -0,0 +1,151 @@
+/**
+ * source.cpp
+ * frame sources for uPose
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#include <opencv2/opencv.hpp>
+
+#include <upose.h>
+
+#include <string.h>
+
+namespace upose {
+    bool VideoCaptureSource::read(cv::Mat& frame) {
+        return m_camera.read(frame) && !frame.empty();
+    }
+
+    bool MemorySource::read(cv::Mat& frame) {
+        if(m_next == m_frames.size()) {
+            if(!m_loop || m_frames.empty()) return false;
+            m_next = 0;
+        }
+
+        frame = m_frames[m_next++];
+        return true;
+    }
+
+    RawSource::RawSource(const std::string& path, cv::Size size) :
+                                m_file(fopen(path.c_str(), "rb")),
+                                m_size(size) {}
+
+    RawSource::~RawSource() {
+        if(m_file) fclose(m_file);
+    }
+
+    bool RawSource::read(cv::Mat& frame) {
+        if(!m_file) return false;
+
+        frame.create(m_size, CV_8UC3);
+
+        /* row by row, so a view into a larger buffer works too */
+        size_t rowBytes = m_size.width * 3;
+
+        for(int y = 0; y < m_size.height; ++y) {
+            if(fread(frame.ptr<uchar>(y), 1, rowBytes, m_file) != rowBytes) return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * the stream header is a line of space-separated tagged fields, such as
+     * "YUV4MPEG2 W640 H480 F30:1 Ip A1:1 C420jpeg". only the size and the
+     * colour space matter here; every 4:2:0 siting variant decodes alike
+     */
+
+    Y4MSource::Y4MSource(const std::string& path) : m_file(fopen(path.c_str(), "rb")) {
+        char header[256];
+
+        if(!m_file || !fgets(header, sizeof(header), m_file)
+                   || strncmp(header, "YUV4MPEG2 ", 10) != 0) {
+            if(m_file) fclose(m_file);
+            m_file = NULL;
+            return;
+        }
+
+        bool planar420 = true;
+
+        for(char* field = strtok(header + 10, " \n"); field; field = strtok(NULL, " \n")) {
+            if(field[0] == 'W') m_size.width = atoi(field + 1);
+            if(field[0] == 'H') m_size.height = atoi(field + 1);
+            if(field[0] == 'C') planar420 = strncmp(field + 1, "420", 3) == 0;
+        }
+
+        if(!planar420 || m_size.area() == 0 || m_size.width % 2 || m_size.height % 2) {
+            fclose(m_file);
+            m_file = NULL;
+            return;
+        }
+
+        m_yuv.create(m_size.height * 3 / 2, m_size.width, CV_8U);
+    }
+
+    Y4MSource::~Y4MSource() {
+        if(m_file) fclose(m_file);
+    }
+
+    bool Y4MSource::read(cv::Mat& frame) {
+        if(!m_file) return false;
+
+        /* each frame is a "FRAME" line, possibly with parameters, then the planes */
+        char marker[256];
+
+        if(!fgets(marker, sizeof(marker), m_file) || strncmp(marker, "FRAME", 5) != 0) return false;
+
+        size_t bytes = m_yuv.total();
+        if(fread(m_yuv.data, 1, bytes, m_file) != bytes) return false;
+
+        cv::cvtColor(m_yuv, frame, cv::COLOR_YUV2BGR_I420);
+        return true;
+    }
+
+    void PushSource::push(const cv::Mat& frame) {
+        cv::Mat copy;
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+
+            if(!m_spare.empty()) {
+                copy = m_spare.back();
+                m_spare.pop_back();
+            }
+        }
+
+        /* outside the lock, so the reader is not held up by the copy */
+        frame.copyTo(copy);
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_frames.push_back(copy);
+        }
+
+        m_ready.notify_one();
+    }
+
+    void PushSource::close() {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_closed = true;
+        }
+
+        m_ready.notify_all();
+    }
+
+    bool PushSource::read(cv::Mat& frame) {
+        std::unique_lock<std::mutex> guard(m_lock);
+        m_ready.wait(guard, [this]() { return m_closed || !m_frames.empty(); });
+
+        if(m_frames.empty()) return false;
+
+        /* the reader is done with the buffer it reads over; recycle it */
+        if(!frame.empty()) m_spare.push_back(frame);
+
+        frame = m_frames.front();
+        m_frames.pop_front();
+
+        return true;
+    }
+}
@@ -0,0 +1,241 @@
+/**
+ * stats.cpp
+ * per-stage latency histograms and tracing for uPose
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#include <upose.h>
+
+namespace upose {
+    const char* stageName(Stage stage) {
+        static const char* names[] = {
+            "read", "segment", "edges", "distance", "track", "optimize", "visualize", "step"
+        };
+
+        static_assert(countof(names) == STAGE_COUNT, "every stage needs a name");
+
+        return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "unknown";
+    }
+
+#ifndef UPOSE_NO_STATS
+    /**
+     * values below 32 have a bucket each; above, a value with its top bit at
+     * e falls in one of 16 buckets spanning [2^e, 2^(e+1)), picked by the 4
+     * bits after the top one
+     */
+
+    int LatencyHistogram::bucket(uint64_t value) {
+        if(value < 2 * SUB_BUCKETS) return value;
+
+        int exponent = std::min(63 - __builtin_clzll(value), (int) MAX_EXPONENT);
+        if(exponent == MAX_EXPONENT && (value >> MAX_EXPONENT) > 1) return BUCKETS - 1;
+
+        return (exponent - 4) * SUB_BUCKETS + (value >> (exponent - 4));
+    }
+
+    /* the middle of a bucket's range */
+
+    uint64_t LatencyHistogram::bucketValue(int bucket) {
+        if(bucket < 2 * SUB_BUCKETS) return bucket;
+
+        int shift = bucket / SUB_BUCKETS - 1;
+        uint64_t mantissa = bucket % SUB_BUCKETS + SUB_BUCKETS;
+
+        return (mantissa << shift) + (1ull << shift) / 2;
+    }
+
+    void LatencyHistogram::record(uint64_t nanoseconds) {
+        m_counts[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while(nanoseconds > max && !m_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {}
+    }
+
+    StageStats LatencyHistogram::summary() const {
+        StageStats stats = { 0, 0, 0, 0, 0, 0 };
+
+        stats.count = m_count.load(std::memory_order_relaxed);
+        stats.max = m_max.load(std::memory_order_relaxed);
+
+        if(stats.count == 0) return stats;
+
+        stats.mean = (double) m_sum.load(std::memory_order_relaxed) / stats.count;
+
+        /* ranks of the percentiles, rounding up as nearest-rank does */
+        uint64_t ranks[] = { (stats.count * 50 + 99) / 100, (stats.count * 90 + 99) / 100, (stats.count * 99 + 99) / 100 };
+        uint64_t* results[] = { &stats.p50, &stats.p90, &stats.p99 };
+
+        uint64_t seen = 0;
+        unsigned int next = 0;
+
+        for(int i = 0; i < BUCKETS && next < countof(ranks); ++i) {
+            seen += m_counts[i].load(std::memory_order_relaxed);
+
+            for(; next < countof(ranks) && seen >= ranks[next]; ++next) {
+                *results[next] = std::min(bucketValue(i), stats.max);
+            }
+        }
+
+        /* counts racing with the reads above can leave a rank unreached */
+        for(; next < countof(ranks); ++next) *results[next] = stats.max;
+
+        return stats;
+    }
+
+    void LatencyHistogram::reset() {
+        for(int i = 0; i < BUCKETS; ++i) m_counts[i].store(0, std::memory_order_relaxed);
+
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+#endif
+
+    void PerfTally::add(const PerfSample& start, const PerfSample& end) {
+        cycles += end.cycles - start.cycles;
+        instructions += end.instructions - start.instructions;
+        cacheMisses += end.cacheMisses - start.cacheMisses;
+        branchMisses += end.branchMisses - start.branchMisses;
+    }
+
+    void StageRecorder::recordPerf(Stage stage, const PerfSample& start, const PerfSample& end,
+                                   const PerfTally& helpers) {
+        PerfSample delta = {
+            end.cycles - start.cycles + helpers.cycles,
+            end.instructions - start.instructions + helpers.instructions,
+            end.cacheMisses - start.cacheMisses + helpers.cacheMisses,
+            end.branchMisses - start.branchMisses + helpers.branchMisses
+        };
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        StagePerf& perf = m_perf[stage];
+
+        perf.last = delta;
+        perf.total.cycles += delta.cycles;
+        perf.total.instructions += delta.instructions;
+        perf.total.cacheMisses += delta.cacheMisses;
+        perf.total.branchMisses += delta.branchMisses;
+        ++perf.runs;
+    }
+
+    StagePerf StageRecorder::perf(Stage stage) const {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_perf[stage];
+    }
+
+    void StageRecorder::reset() {
+        std::lock_guard<std::mutex> lock(m_lock);
+        memset(m_perf, 0, sizeof(m_perf));
+    }
+
+    /**
+     * Tracer: spans go to a ring owned by the recording thread, registered
+     * once under a lock. timestamps count from the first span recorded
+     */
+
+    std::atomic<bool> Tracer::s_enabled(false);
+
+    namespace {
+        struct TraceEvent {
+            Stage stage;
+            int context;
+            uint64_t start, duration; /* in nanoseconds */
+        };
+
+        struct TraceRing {
+            int thread;
+            std::atomic<uint64_t> written;
+            TraceEvent events[Tracer::TRACE_EVENTS];
+        };
+
+        std::mutex& traceLock() {
+            static std::mutex lock;
+            return lock;
+        }
+
+        std::vector<std::unique_ptr<TraceRing> >& traceRings() {
+            static std::vector<std::unique_ptr<TraceRing> > rings;
+            return rings;
+        }
+
+        Tracer::Time traceEpoch() {
+            static Tracer::Time epoch = std::chrono::steady_clock::now();
+            return epoch;
+        }
+
+        thread_local TraceRing* t_ring = NULL;
+    }
+
+    void Tracer::enable(bool enabled) {
+        traceEpoch();
+        s_enabled = enabled;
+    }
+
+    void Tracer::record(Stage stage, int context, Time start, Time end) {
+        if(!t_ring) {
+            std::lock_guard<std::mutex> lock(traceLock());
+
+            t_ring = new TraceRing();
+            t_ring->thread = traceRings().size();
+            t_ring->written = 0;
+
+            traceRings().push_back(std::unique_ptr<TraceRing>(t_ring));
+        }
+
+        uint64_t index = t_ring->written.load(std::memory_order_relaxed);
+        TraceEvent& event = t_ring->events[index % TRACE_EVENTS];
+
+        event.stage = stage;
+        event.context = context;
+        event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - traceEpoch()).count();
+        event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+        t_ring->written.store(index + 1, std::memory_order_release);
+    }
+
+    void Tracer::clear() {
+        std::lock_guard<std::mutex> lock(traceLock());
+
+        for(auto& ring : traceRings()) ring->written = 0;
+    }
+
+    /* complete ("X") events with microsecond times, one track per thread */
+
+    bool Tracer::dump(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "w");
+        if(!file) return false;
+
+        std::lock_guard<std::mutex> lock(traceLock());
+
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+        bool first = true;
+
+        for(auto& ring : traceRings()) {
+            uint64_t written = ring->written.load(std::memory_order_acquire),
+                     oldest = written > TRACE_EVENTS ? written - TRACE_EVENTS : 0;
+
+            fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                          "\"args\": {\"name\": \"upose thread %d\"}}",
+                    first ? "" : ",", ring->thread, ring->thread);
+            first = false;
+
+            for(uint64_t i = oldest; i < written; ++i) {
+                const TraceEvent& event = ring->events[i % TRACE_EVENTS];
+
+                fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"upose\", \"ph\": \"X\", "
+                              "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, "
+                              "\"args\": {\"context\": %d}}",
+                        stageName(event.stage), event.start / 1e3, event.duration / 1e3,
+                        ring->thread, event.context);
+            }
+        }
+
+        fprintf(file, "\n]}\n");
+
+        return fclose(file) == 0;
+    }
+}
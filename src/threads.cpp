@@ -0,0 +1,334 @@
+/**
+ * threads.cpp
+ * worker threads and stream scheduling for uPose
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#include <upose.h>
+
+namespace upose {
+    /* the pool and queue index of the current worker thread, if any */
+    static thread_local ThreadPool* t_pool = NULL;
+    static thread_local int t_index = -1;
+
+    /**
+     * ThreadPool: a work-stealing scheduler
+     * each worker owns a deque: it pushes and pops at the back (LIFO, cache
+     * warm) while idle workers steal from the front of others (FIFO, oldest
+     * and usually largest work first). threads outside the pool submit
+     * round-robin across the deques
+     */
+
+    ThreadPool::ThreadPool(int threads) :
+                                m_queueCount(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())),
+                                m_pending(0),
+                                m_submitted(0),
+                                m_quit(false) {
+        m_queues.reset(new Queue[m_queueCount]);
+
+        for(int i = 0; i < m_queueCount; ++i) {
+            m_threads.push_back(std::thread(&ThreadPool::work, this, i));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleep);
+            m_quit = true;
+        }
+
+        m_wake.notify_all();
+
+        for(unsigned int i = 0; i < m_threads.size(); ++i) {
+            m_threads[i].join();
+        }
+    }
+
+    /* tasks are swapped in and out, so a slot never keeps a finished task alive */
+
+    void ThreadPool::Queue::grow() {
+        std::vector<Task> grown(2 * tasks.size());
+
+        for(size_t i = 0; i < count; ++i) {
+            grown[i].swap(tasks[(head + i) % tasks.size()]);
+        }
+
+        tasks.swap(grown);
+        head = 0;
+    }
+
+    void ThreadPool::Queue::pushBack(Task& task) {
+        if(count == tasks.size()) grow();
+
+        tasks[(head + count++) % tasks.size()].swap(task);
+    }
+
+    void ThreadPool::Queue::pushFront(Task& task) {
+        if(count == tasks.size()) grow();
+
+        head = (head + tasks.size() - 1) % tasks.size();
+        tasks[head].swap(task);
+        ++count;
+    }
+
+    void ThreadPool::Queue::popBack(Task& task) {
+        task.swap(tasks[(head + --count) % tasks.size()]);
+    }
+
+    void ThreadPool::Queue::popFront(Task& task) {
+        task.swap(tasks[head]);
+        head = (head + 1) % tasks.size();
+        --count;
+    }
+
+    int ThreadPool::size() const {
+        return m_queueCount;
+    }
+
+    void ThreadPool::submit(Task task) {
+        enqueue(task, false);
+    }
+
+    void ThreadPool::post(Task task) {
+        enqueue(task, true);
+    }
+
+    /**
+     * a worker's own tasks go to its queue, others' round-robin. submitted
+     * tasks go to the back, run next by the owner; posted tasks go to the
+     * front, run by the owner only after everything queued before them
+     */
+
+    void ThreadPool::enqueue(Task& task, bool behind) {
+        int index = t_pool == this ? t_index : m_submitted++ % m_queueCount;
+
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index].lock);
+
+            if(behind) {
+                m_queues[index].pushFront(task);
+            } else {
+                m_queues[index].pushBack(task);
+            }
+        }
+
+        /* taking the sleep lock orders this against a worker about to wait */
+        {
+            std::lock_guard<std::mutex> lock(m_sleep);
+            ++m_pending;
+        }
+
+        m_wake.notify_one();
+    }
+
+    bool ThreadPool::runOne() {
+        int self = t_pool == this ? t_index : 0;
+        Task task;
+
+        for(int i = 0; i < m_queueCount && !task; ++i) {
+            Queue& queue = m_queues[(self + i) % m_queueCount];
+            std::lock_guard<std::mutex> lock(queue.lock);
+
+            if(queue.count == 0) continue;
+
+            /* own work from the back, stolen work from the front */
+            if(i == 0 && t_pool == this) {
+                queue.popBack(task);
+            } else {
+                queue.popFront(task);
+            }
+        }
+
+        if(!task) return false;
+
+        --m_pending;
+        task();
+
+        return true;
+    }
+
+    void ThreadPool::work(int index) {
+        t_pool = this;
+        t_index = index;
+
+        for(;;) {
+            if(runOne()) continue;
+
+            std::unique_lock<std::mutex> lock(m_sleep);
+            m_wake.wait(lock, [this] { return m_quit || m_pending > 0; });
+
+            if(m_quit) return;
+        }
+    }
+
+    void ThreadPool::parallelFor(int count, const std::function<void(int)>& body, PerfTally* tally) {
+        if(count <= 1 || m_queueCount <= 1) {
+            for(int i = 0; i < count; ++i) body(i);
+            return;
+        }
+
+        /* helpers claim indices from a shared counter until it runs out. a
+         * helper captures only a reference to this, so a Task holds it inline */
+        struct Loop {
+            std::atomic<int> next, finished;
+            int count;
+            const std::function<void(int)>& body;
+            PerfTally* tally;
+
+            void drain() {
+                for(int i = next++; i < count; i = next++) body(i);
+            }
+        } loop = { {0}, {0}, count, body, tally };
+
+        int helpers = std::min(count, m_queueCount) - 1;
+
+        for(int i = 0; i < helpers; ++i) {
+            submit([&loop]() {
+                PerfSample start, end;
+                bool counting = loop.tally && readPerfCounters(start);
+
+                loop.drain();
+
+                if(counting && readPerfCounters(end)) loop.tally->add(start, end);
+                ++loop.finished;
+            });
+        }
+
+        loop.drain();
+
+        /* the helpers reference this frame, so wait for all of them. run other
+         * tasks meanwhile: nested loops from a worker must not deadlock */
+        while(loop.finished < helpers) {
+            if(!runOne()) std::this_thread::yield();
+        }
+    }
+
+    /**
+     * StreamPool: steps many contexts over one ThreadPool
+     * each stream has at most one step in flight, reposted when it
+     * finishes, so a stream's frames are processed in order while streams
+     * interleave freely across the workers. posting queues the next step
+     * behind the other streams' rather than running it straight away, so
+     * with more streams than workers they take turns. a stream whose
+     * source runs dry is retired rather than reposted
+     */
+
+    StreamPool::StreamPool(ThreadPool& pool) :
+                                m_pool(pool),
+                                m_running(false),
+                                m_inFlight(0),
+                                m_frames(0) {}
+
+    StreamPool::~StreamPool() {
+        stop();
+    }
+
+    int StreamPool::add(cv::VideoCapture& camera, uint64_t seed) {
+        CV_Assert(!m_running);
+
+        return adopt(new Stream(camera, seed));
+    }
+
+    int StreamPool::add(FrameSource& source, uint64_t seed) {
+        CV_Assert(!m_running);
+
+        return adopt(new Stream(source, seed));
+    }
+
+    int StreamPool::adopt(Stream* stream) {
+        stream->context.setThreadPool(&m_pool);
+
+        m_streams.push_back(std::unique_ptr<Stream>(stream));
+        return m_streams.size() - 1;
+    }
+
+    Context& StreamPool::context(int stream) {
+        return m_streams[stream]->context;
+    }
+
+    int StreamPool::size() const {
+        return m_streams.size();
+    }
+
+    void StreamPool::setPoseSink(PoseSink sink) {
+        CV_Assert(!m_running);
+        m_sink = sink;
+    }
+
+    void StreamPool::start() {
+        if(m_running) return;
+
+        m_started = std::chrono::steady_clock::now();
+        m_ended = m_started;
+        m_frames = 0;
+        m_inFlight = m_streams.size();
+        m_running = true;
+
+        for(unsigned int i = 0; i < m_streams.size(); ++i) {
+            m_streams[i]->frames = 0;
+            schedule(i);
+        }
+    }
+
+    void StreamPool::stop() {
+        m_running = false;
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_idle.wait(lock, [this] { return m_inFlight == 0; });
+    }
+
+    void StreamPool::schedule(int index) {
+        m_pool.post([this, index]() {
+            Stream& stream = *m_streams[index];
+            Pose pose = stream.context.step();
+
+            if(!pose.valid) {
+                retire();
+                return;
+            }
+
+            ++stream.frames;
+            ++m_frames;
+
+            if(m_sink) m_sink(index, pose);
+
+            if(m_running) {
+                schedule(index);
+            } else {
+                retire();
+            }
+        });
+    }
+
+    void StreamPool::retire() {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        if(--m_inFlight == 0) {
+            m_ended = std::chrono::steady_clock::now();
+            m_idle.notify_all();
+        }
+    }
+
+    StreamPool::Throughput StreamPool::throughput() const {
+        Throughput t;
+
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if(m_inFlight == 0) end = m_ended;
+        }
+
+        t.frames = m_frames;
+        t.seconds = std::chrono::duration<double>(end - m_started).count();
+        t.fps = t.seconds > 0 ? t.frames / t.seconds : 0;
+
+        for(unsigned int i = 0; i < m_streams.size(); ++i) {
+            t.streamFrames.push_back(m_streams[i]->frames);
+        }
+
+        return t;
+    }
+}
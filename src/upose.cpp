@@ -12,93 +12,128 @@
 
 namespace upose {
     /**
-     * implements a crude, random search to optimize a function
-     * TODO: switch to an advanced optimization algorithm
+     * Context class: maintains a skeletal tracking context
+     * the constructor initializes background subtraction, 2d tracking
      */
 
-    void optimizeRandomSearch(
-            int (*cost)(int*, void*), /* cost function to minimize */
-            int dimension, /* dimension of cost function */
-            int iterationCount, /* number of iterations to run */
-            int radius, /* radius of hypersphere */
-            int* optimum, /* on entry, initial guess. on exit, minimum */
-            void* context /* pointer passed to the cost function */
-        ) {
-        size_t size = sizeof(int) * dimension;
+    Context::Context(uint64_t seed) : m_source(NULL),
+                                      m_pipelined(false),
+                                      m_capturing(false),
+                                      m_frameIndex(0),
+                                      m_trackRegion(true),
+                                      m_edgePoints(false),
+                                      m_levels(1),
+                                      m_roiAge(0),
+                                      m_random(seed),
+                                      m_pool(NULL) {
+        static std::atomic<int> contexts(0);
+        m_stats.context = contexts++;
 
-        int* candidate = (int*) malloc(size);
-        memcpy(candidate, optimum, size);
+        for(unsigned int i = 0; i < countof(m_skeleton); ++i) {
+            m_skeleton[i] = 0;
+        }
 
-        int best = cost(optimum, context);
+        for(int i = 0; i < BODY_PARTS; ++i) {
+            m_found[i] = false;
+        }
 
-        for(int iteration = 0; iteration < iterationCount; ++iteration) {
-            /* step algorithm */
-            int dim = iteration % dimension,
-                change = (rand() % (2*radius)) - radius;
+        for(int i = 0; i < FRAME_RING; ++i) {
+            m_borrowed[i] = false;
+        }
+    }
 
-            candidate[dim] = optimum[dim] + change;
+    Context::Context(FrameSource& source, uint64_t seed) : Context(seed) {
+        m_source = &source;
 
-            /* save if a better solution */
-            int candidateCost = cost(candidate, context);
+        if(m_source->read(m_frames[m_frameIndex])) learnBackground(m_frames[m_frameIndex]);
+    }
 
-            if(candidateCost < best) {
-                memcpy(optimum, candidate, size);
-                best = candidateCost;
-            } else {
-                candidate[dim] = optimum[dim];
-            }
-        }
+    Context::Context(cv::VideoCapture& camera, uint64_t seed) : Context(seed) {
+        m_ownedSource.reset(new VideoCaptureSource(camera));
+        m_source = m_ownedSource.get();
 
-        free(candidate);
+        if(m_source->read(m_frames[m_frameIndex])) learnBackground(m_frames[m_frameIndex]);
     }
 
     /**
-     * Context class: maintains a skeletal tracking context
-     * the constructor initializes background subtraction, 2d tracking
+     * starts the background model over from a frame, as on the first frame
+     * or when the source switches resolution. the background is updated in
+     * place, so it gets its own copy; the tracked region belonged to the old
+     * frame and is dropped
      */
 
-    Context::Context(cv::VideoCapture& camera) : m_camera(camera) {
-        m_camera.read(m_background);
-        m_lastFrame = m_background;
+    void Context::learnBackground(const cv::Mat& frame) {
+        m_background = frame.clone();
+        m_backgroundFraction = cv::Mat::zeros(m_background.size(), m_background.type());
 
-        for(unsigned int i = 0; i < countof(m_skeleton); ++i) {
-            m_skeleton[i] = 0;
-        }
-   }
+        m_roi = cv::Rect();
+        m_roiAge = 0;
+    }
 
-    cv::Mat Context::backgroundSubtract(cv::Mat frame) {
-        cv::Mat foreground = cv::abs(m_background - frame);
-        cv::cvtColor(foreground > 0.25*frame, foreground, CV_BGR2GRAY);
+    cv::Mat MatArena::get(int buffer, cv::Size size, int type) {
+        cv::Mat& storage = m_buffers[buffer];
 
-        cv::blur(foreground > 0, foreground, cv::Size(5, 5));
-        return foreground > 254;
+        if(storage.type() != type || storage.cols < size.width || storage.rows < size.height) {
+            storage.create(std::max(storage.rows, size.height), std::max(storage.cols, size.width), type);
+            ++m_allocations;
+        }
+
+        return storage(cv::Rect(0, 0, size.width, size.height));
     }
 
-     /**
-      * convert frame to (Y)I(Q) space for skin color thresholding
-      * the Y and Q components are not necessary, however.
-      * algorithm from Brand and Mason 2000
-      * "A comparative assessment of three approaches to pixel level human skin-detection"
-      */
+    /**
+     * segments the region roi of the frame into foreground and skin masks
+     * the per-pixel tests run in one fused pass (see segment.cpp), after which
+     * the frame is blended into the adaptive background model; the masks
+     * are then cleaned up with the equivalents of the old thresholded blurs:
+     *   foreground: eroded 5x5
+     *   skin: restricted to the foreground, eroded 3x3, then dilated 9x9
+     * the same pass measures motion energy against the previous frame; pixels
+     * moving more than MOTION_THRESHOLD, like the foreground, only seep
+     * slowly into the background, so a person standing in a spot the model
+     * wrongly learnt is not absorbed
+     * the skin test converts to (Y)I(Q) space; Y and Q are not necessary.
+     * algorithm from Brand and Mason 2000
+     * "A comparative assessment of three approaches to pixel level human skin-detection"
+     */
+
+    void Context::segment(cv::Mat frame, cv::Mat previous, cv::Rect roi, MatArena& arena,
+                          cv::Mat& foreground, cv::Mat& skin, cv::Mat& motion) {
+        static const cv::Mat erode5 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(5, 5)),
+                             erode3 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3)),
+                             dilate9 = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(9, 9));
 
-    cv::Mat Context::skinRegions(cv::Mat frame, cv::Mat foreground) {
-        cv::Mat bgr[3];
-        cv::split(frame, bgr);
+        cv::Mat pixels = frame(roi), background = m_background(roi), fraction = m_backgroundFraction(roi);
 
-        cv::Mat map = (0.6*bgr[2]) - (0.3*bgr[1]) - (0.3*bgr[0]);
-        cv::Mat skin = (map > 1) & (map < 16);
+        cv::Mat rawForeground = arena.get(MatArena::BUFFER_RAW_FOREGROUND, roi.size(), CV_8U),
+                rawSkin = arena.get(MatArena::BUFFER_RAW_SKIN, roi.size(), CV_8U),
+                erodedSkin = arena.get(MatArena::BUFFER_ERODED_SKIN, roi.size(), CV_8U);
 
-        cv::Mat tracked = foreground & skin;
+        foreground = arena.get(MatArena::BUFFER_FOREGROUND, roi.size(), CV_8U);
+        skin = arena.get(MatArena::BUFFER_SKIN, roi.size(), CV_8U);
+        motion = arena.get(MatArena::BUFFER_MOTION, roi.size(), CV_8U);
 
-        cv::blur(tracked, tracked, cv::Size(3, 3));
-        cv::blur(tracked > 254, tracked, cv::Size(9, 9));
+        /* a camera switching resolution has no usable previous frame */
+        cv::Mat before = previous.size() == frame.size() ? previous(roi) : cv::Mat();
+        segmentPixels(pixels, background, before, rawForeground, rawSkin, motion);
 
-        return tracked > 0;
+        cv::Mat held = arena.get(MatArena::BUFFER_HELD, roi.size(), CV_8U);
+        cv::compare(motion, cv::Scalar(MOTION_THRESHOLD), held, cv::CMP_GT);
+        cv::bitwise_or(rawForeground, held, held);
+        updateBackground(pixels, held, background, fraction);
+
+        /* reflected borders, as cv::blur used */
+        cv::Point anchor(-1, -1);
+
+        cv::erode(rawForeground, foreground, erode5, anchor, 1, cv::BORDER_REFLECT_101);
+
+        cv::bitwise_and(rawSkin, foreground, rawSkin);
+        cv::erode(rawSkin, erodedSkin, erode3, anchor, 1, cv::BORDER_REFLECT_101);
+        cv::dilate(erodedSkin, skin, dilate9, anchor, 1, cv::BORDER_REFLECT_101);
     }
 
-    
     /* the hand is the farthest point from the point closest to the shoulder */
-    cv::Point sleeveNormalize(std::vector<cv::Point> contour, cv::Point shoulder) {
+    cv::Point sleeveNormalize(const std::vector<cv::Point>& contour, cv::Point shoulder) {
         int bestDist = 100000, bestIndex = 0;
 
         for(unsigned int i = 0; i < contour.size(); ++i) {
@@ -113,170 +148,950 @@ namespace upose {
         return contour[(bestIndex + contour.size()/2) % contour.size()];
     }
 
+    /* a counting sort of the edge pixels by cell; the vectors keep their capacity */
+
+    void EdgeGrid::build(const cv::Mat& edges, cv::Point origin) {
+        m_origin = origin;
+        m_cols = (edges.cols + CHAMFER_TRUNCATION - 1) / CHAMFER_TRUNCATION;
+        m_rows = (edges.rows + CHAMFER_TRUNCATION - 1) / CHAMFER_TRUNCATION;
+
+        cv::findNonZero(edges, m_unsorted);
+
+        /* m_start[c + 1] counts cell c, then becomes where it begins */
+        m_start.assign(m_cols * m_rows + 1, 0);
+
+        for(const cv::Point& p : m_unsorted) {
+            ++m_start[(p.y / CHAMFER_TRUNCATION) * m_cols + p.x / CHAMFER_TRUNCATION + 1];
+        }
+
+        for(size_t c = 1; c < m_start.size(); ++c) {
+            m_start[c] += m_start[c - 1];
+        }
+
+        /* filling advances each cell's start to the next cell's; shift back */
+        m_points.resize(m_unsorted.size());
+
+        for(const cv::Point& p : m_unsorted) {
+            m_points[m_start[(p.y / CHAMFER_TRUNCATION) * m_cols + p.x / CHAMFER_TRUNCATION]++] = p + origin;
+        }
+
+        for(size_t c = m_start.size() - 1; c > 0; --c) {
+            m_start[c] = m_start[c - 1];
+        }
+
+        m_start[0] = 0;
+    }
+
+    void EdgeGrid::clear() {
+        m_cols = m_rows = 0;
+        m_start.clear();
+        m_points.clear();
+    }
+
+    /* floor division, for coordinates left of or above the grid */
+    static int cellOf(int v) {
+        return v >= 0 ? v / CHAMFER_TRUNCATION : -((CHAMFER_TRUNCATION - 1 - v) / CHAMFER_TRUNCATION);
+    }
+
+    float EdgeGrid::nearest(cv::Point p) const {
+        int x = p.x - m_origin.x, y = p.y - m_origin.y;
+
+        int x0 = std::max(0, cellOf(x - CHAMFER_TRUNCATION)), x1 = std::min(m_cols - 1, cellOf(x + CHAMFER_TRUNCATION)),
+            y0 = std::max(0, cellOf(y - CHAMFER_TRUNCATION)), y1 = std::min(m_rows - 1, cellOf(y + CHAMFER_TRUNCATION));
+
+        int best = CHAMFER_TRUNCATION * CHAMFER_TRUNCATION;
+
+        for(int cy = y0; cy <= y1; ++cy) {
+            for(int cx = x0; cx <= x1; ++cx) {
+                int cell = cy * m_cols + cx;
+
+                for(int i = m_start[cell]; i < m_start[cell + 1]; ++i) {
+                    int dx = m_points[i].x - p.x, dy = m_points[i].y - p.y;
+                    best = std::min(best, dx*dx + dy*dy);
+                }
+            }
+        }
+
+        return sqrtf((float) best);
+    }
+
     /**
-     * tracks 2D features only, in 2D coordinates
-     * that is, the face, the hands, and the feet
+     * one pass over the labels. cv::connectedComponentsWithStats would tally
+     * these too, but it reallocates its output whenever the number of blobs
+     * changes; assign() into the arrays reuses their capacity. while
+     * scanning, a box holds its corners, (x, y) and (width, height)
      */
 
-    void Context::track2DFeatures(cv::Mat skin) {
-        std::vector<std::vector<cv::Point> > contours;
-        cv::findContours(skin, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    void BlobStats::load(const cv::Mat& labels, int count, cv::Point origin) {
+        int blobs = std::max(0, count - 1);
 
-        std::vector<cv::Rect> boundings;
-        std::vector<cv::Point> centroids;
-        std::vector<std::vector<int> > costs;
+        area.assign(blobs, 0);
+        box.assign(blobs, cv::Rect(INT_MAX, INT_MAX, -1, -1));
+        centre.resize(blobs);
 
-        if(contours.size() >= 3) {
-            for(unsigned int i = 0; i < contours.size(); ++i) {
-                cv::Rect bounding = cv::boundingRect(contours[i]);
+        for(int y = 0; y < labels.rows; ++y) {
+            const int* row = labels.ptr<int>(y);
 
-                cv::Point centroid = (bounding.tl() + bounding.br()) * 0.5;
+            for(int x = 0; x < labels.cols; ++x) {
+                int blob = row[x] - 1;
+                if(blob < 0) continue;
 
-                centroids.push_back(centroid);
-                boundings.push_back(bounding);
+                cv::Rect& corners = box[blob];
+                ++area[blob];
 
-                int w = bounding.width;
+                corners.x = std::min(corners.x, x);
+                corners.y = std::min(corners.y, y);
+                corners.width = std::max(corners.width, x);
+                corners.height = std::max(corners.height, y);
+            }
+        }
 
-                std::vector<int> cost;
-                cost.push_back(cv::norm(m_last2D.face - centroid) + centroid.y - w);
-                cost.push_back(cv::norm(m_lastu2D.leftHand - centroid) + centroid.x - w);
-                cost.push_back(cv::norm(m_lastu2D.rightHand - centroid) + (skin.cols - centroid.x) - w);
+        for(int i = 0; i < blobs; ++i) {
+            cv::Rect& bounding = box[i];
 
-                costs.push_back(cost);
-            }
+            bounding = cv::Rect(bounding.x + origin.x, bounding.y + origin.y,
+                                bounding.width - bounding.x + 1, bounding.height - bounding.y + 1);
+            centre[i] = (bounding.tl() + bounding.br()) * 0.5;
+        }
+    }
 
-            std::vector<int> minCost = {
-                    (skin.rows*skin.rows + skin.cols*skin.cols) / 64,
-                    (skin.rows*skin.rows + skin.cols*skin.cols) / 64,
-                    (skin.rows*skin.rows + skin.cols*skin.cols) / 64
-            };
+    /**
+     * border following after Suzuki and Abe 1985, as cv::findContours does
+     * it, for a single outer border: from the first pixel in raster order,
+     * each step takes the first blob pixel counter-clockwise from the way
+     * back, and a point is kept where the direction changes. the points and
+     * their order match findContours, without its padded copy of the image
+     * and its storage; contour keeps its capacity from call to call
+     */
 
-            std::vector<int> indices = { -1, -1, -1 };
+    void traceOutline(const cv::Mat& labels, int label, cv::Rect box, cv::Point offset,
+                      std::vector<cv::Point>& contour) {
+        /* chain codes: right, then counter-clockwise on screen */
+        static const cv::Point steps[] = {
+            cv::Point(1, 0), cv::Point(1, -1), cv::Point(0, -1), cv::Point(-1, -1),
+            cv::Point(-1, 0), cv::Point(-1, 1), cv::Point(0, 1), cv::Point(1, 1)
+        };
 
-            /* minimize errors */
+        auto inside = [&](cv::Point p) { return box.contains(p) && labels.at<int>(p) == label; };
 
-            for(unsigned int i = 0; i < contours.size(); ++i) {
-                for(unsigned int p = 0; p < 3; ++p) {
-                    if(costs[i][p] < minCost[p]) {
-                        minCost[p] = costs[i][p];
-                        indices[p] = i;
-                    }
+        contour.clear();
+
+        /* the box is tight, so its top row holds the first pixel */
+        cv::Point start(box.x, box.y);
+        while(start.x < box.x + box.width && !inside(start)) ++start.x;
+
+        if(start.x == box.x + box.width) return;
+
+        /* the border ends on the first neighbour clockwise from the left */
+        int s = 4;
+        cv::Point last;
+
+        do {
+            s = (s - 1) & 7;
+            last = start + steps[s];
+        } while(!inside(last) && s != 4);
+
+        if(s == 4) {
+            contour.push_back(start + offset);
+            return;
+        }
+
+        cv::Point p = start, next;
+        int previous = s ^ 4;
+
+        for(;;) {
+            /* eight steps round lead back where p was entered from, at worst */
+            for(int k = 1; k <= 8; ++k) {
+                next = p + steps[(s + k) & 7];
+
+                if(inside(next)) {
+                    s = (s + k) & 7;
+                    break;
                 }
             }
 
-            if(indices[0] > -1) m_last2D.face      = centroids[indices[0]];
-            if(indices[1] > -1) m_lastu2D.leftHand  = centroids[indices[1]];
-            if(indices[2] > -1) m_lastu2D.rightHand = centroids[indices[2]];
+            if(s != previous) {
+                contour.push_back(p + offset);
+                previous = s;
+            }
 
-            /* assign shoulder positions relative to face */
+            if(next == start && p == last) break;
 
-            if(indices[0] > -1) {
-                cv::Rect face = boundings[indices[0]];
-                cv::Point neck = cv::Point(face.x, face.y + 2*face.width);
+            p = next;
+            s = (s + 4) & 7;
+        }
+    }
 
-                m_last2D.neck = neck;
-                m_last2D.leftShoulder = neck + cv::Point(-face.width / 2, 0);
-                m_last2D.rightShoulder = neck + cv::Point(3*face.width / 2, 0);
-            }
+    /**
+     * tracks 2D features only, in 2D coordinates
+     * that is, the face, the hands, and the feet
+     *
+     * skin blobs come from one connected-component pass with statistics.
+     * the largest blobs are assigned to the face and hands jointly, by their
+     * last positions and expected places in the frame; a part found last
+     * frame only looks within TRACK_GATE of it. outlines are traced only
+     * for the hands
+     */
+
+    void Context::track2DFeatures(cv::Mat skin, cv::Rect roi, cv::Size frame, MatArena& arena) {
+        m_blobLabels = arena.get(MatArena::BUFFER_BLOB_LABELS, skin.size(), CV_32S);
+
+        int labels = cv::connectedComponents(skin, m_blobLabels, 8, CV_32S);
+        m_blobs.load(m_blobLabels, labels, roi.tl());
+
+        if(m_blobs.size() < 3) return;
+
+        /* the largest blobs, by insertion into a short sorted list */
+        int candidates[MAX_TRACKED_BLOBS], count = 0;
 
-            /* adjust for sleeves */
-            if(indices[1] > -1) {
-                m_last2D.leftHand = sleeveNormalize(
-                        contours[indices[1]], 
-                        m_last2D.leftShoulder
-                    );
+        for(int i = 0; i < (int) m_blobs.size(); ++i) {
+            int j = std::min(count, MAX_TRACKED_BLOBS - 1);
+            if(j == count) ++count;
+            else if(m_blobs.area[candidates[j]] >= m_blobs.area[i]) continue;
+
+            for(; j > 0 && m_blobs.area[candidates[j - 1]] < m_blobs.area[i]; --j) {
+                candidates[j] = candidates[j - 1];
             }
 
-            if(indices[2] > -1) {
-                m_last2D.rightHand = sleeveNormalize(
-                        contours[indices[2]], 
-                        m_last2D.rightShoulder
-                    );
+            candidates[j] = i;
+        }
+
+        cv::Point last[] = { m_last2D.face, m_lastu2D.leftHand, m_lastu2D.rightHand };
+
+        int diagonal = (frame.height*frame.height + frame.width*frame.width) / 64;
+        int gate[] = { diagonal, diagonal, diagonal };
+        int costs[MAX_TRACKED_BLOBS][BODY_PARTS];
+
+        for(int b = 0; b < count; ++b) {
+            cv::Point centroid = m_blobs.centre[candidates[b]];
+            int w = m_blobs.box[candidates[b]].width;
+
+            costs[b][PART_FACE] = cv::norm(last[PART_FACE] - centroid) + centroid.y - w;
+            costs[b][PART_LEFT_HAND] = cv::norm(last[PART_LEFT_HAND] - centroid) + centroid.x - w;
+            costs[b][PART_RIGHT_HAND] = cv::norm(last[PART_RIGHT_HAND] - centroid) + (frame.width - centroid.x) - w;
+
+            /* a part seen last frame cannot jump across the frame */
+            for(int p = 0; p < BODY_PARTS; ++p) {
+                if(m_found[p] && cv::norm(last[p] - centroid) > TRACK_GATE) {
+                    costs[b][p] = INT_MAX;
+                }
             }
         }
+
+        /* one blob per part, chosen jointly, so two parts never share a blob */
+        int assignment[BODY_PARTS];
+        assignParts(costs, count, gate, assignment);
+
+        int indices[BODY_PARTS];
+
+        for(int p = 0; p < BODY_PARTS; ++p) {
+            indices[p] = assignment[p] < 0 ? -1 : candidates[assignment[p]];
+            m_found[p] = indices[p] > -1;
+        }
+
+        if(indices[0] > -1) m_last2D.face      = m_blobs.centre[indices[0]];
+        if(indices[1] > -1) m_lastu2D.leftHand  = m_blobs.centre[indices[1]];
+        if(indices[2] > -1) m_lastu2D.rightHand = m_blobs.centre[indices[2]];
+
+        /* assign shoulder positions relative to face */
+
+        if(indices[0] > -1) {
+            cv::Rect face = m_blobs.box[indices[0]];
+            cv::Point neck = cv::Point(face.x, face.y + 2*face.width);
+
+            m_last2D.neck = neck;
+            m_last2D.leftShoulder = neck + cv::Point(-face.width / 2, 0);
+            m_last2D.rightShoulder = neck + cv::Point(3*face.width / 2, 0);
+        }
+
+        /* adjust for sleeves; the label of blob i is i + 1 */
+        if(indices[1] > -1) {
+            traceOutline(m_blobLabels, indices[1] + 1, m_blobs.box[indices[1]] - roi.tl(), roi.tl(), m_outline);
+            m_last2D.leftHand = sleeveNormalize(m_outline, m_last2D.leftShoulder);
+        }
+
+        if(indices[2] > -1) {
+            traceOutline(m_blobLabels, indices[2] + 1, m_blobs.box[indices[2]] - roi.tl(), roi.tl(), m_outline);
+            m_last2D.rightHand = sleeveNormalize(m_outline, m_last2D.rightShoulder);
+        }
     }
 
-    cv::Mat Context::edges(cv::Mat frame) {
-        cv::Mat edges;
-        cv::blur(frame, edges, cv::Size(3, 3));
-        cv::Canny(edges, edges, 32, 32 * 2, 3);
+    /**
+     * outlines of both masks in a single pass. the masks are packed into one
+     * label image (bit 0 foreground, bit 1 skin); a pixel lies on an outline
+     * when a 4-neighbour carries a lower label, which is one erosion and one
+     * compare. this marks the inner boundary of every region, including skin
+     * inside the foreground, one pixel thick like Canny on the binary masks
+     */
+
+    cv::Mat Context::edges(cv::Mat foreground, cv::Mat skin, MatArena& arena) {
+        static const cv::Mat cross3 = cv::getStructuringElement(cv::MORPH_CROSS, cv::Size(3, 3));
+
+        cv::Mat label = arena.get(MatArena::BUFFER_LABEL, foreground.size(), CV_8U),
+                scratch = arena.get(MatArena::BUFFER_SCRATCH, foreground.size(), CV_8U),
+                edges = arena.get(MatArena::BUFFER_EDGES, foreground.size(), CV_8U);
+
+        cv::bitwise_and(foreground, cv::Scalar(1), label);
+        cv::bitwise_and(skin, cv::Scalar(2), scratch);
+        cv::bitwise_or(label, scratch, label);
+
+        cv::erode(label, scratch, cross3);
+        cv::compare(label, scratch, edges, cv::CMP_GT);
+
         return edges;
     }
 
-    cv::Point jointPoint2(int* joints, int index) {
+    cv::Point jointPoint2(const int* joints, int index) {
         return cv::Point(joints[index], joints[index + 1]);
     }
 
-    /* given a list of connected points, draw the outline and compute cost */
+    /* intersects [x0, x1] with the solutions of lo <= k*x + m <= hi */
+    bool clipLinear(double k, double m, double lo, double hi, double& x0, double& x1) {
+        if(k == 0) return lo <= m && m <= hi;
 
-    int drawModelOutline(cv::Mat outline, cv::Point* lines, size_t count) {
-        int cost = 0;
+        double a = (lo - m) / k, b = (hi - m) / k;
+        if(k < 0) std::swap(a, b);
 
-        for(unsigned int i = 0; i < count; i += 2) {
-            cv::line(outline, lines[i], lines[i+1], cv::Scalar::all(255), 50);
+        x0 = std::max(x0, a);
+        x1 = std::min(x1, b);
+
+        return x0 <= x1;
+    }
 
-            cost += cv::norm(lines[i] - lines[i+1]);
+    /**
+     * the span of row y covered by a capsule (a thick segment with round caps,
+     * as drawn by cv::line) of the given radius around ab
+     * the capsule is convex, so the span is the hull of the two caps and the body
+     */
+
+    bool capsuleRowSpan(cv::Point a, cv::Point b, int radius, double y, double& x0, double& x1) {
+        double r = radius;
+
+        x0 = 1e9;
+        x1 = -1e9;
+
+        /* round caps */
+        cv::Point ends[] = { a, b };
+
+        for(unsigned int i = 0; i < countof(ends); ++i) {
+            double dy = y - ends[i].y;
+
+            if(dy*dy <= r*r) {
+                double w = sqrt(r*r - dy*dy);
+                x0 = std::min(x0, ends[i].x - w);
+                x1 = std::max(x1, ends[i].x + w);
+            }
         }
 
-        return cost;
+        /* body: perpendicular distance within r, projection within the segment */
+        double dx = b.x - a.x, dy = b.y - a.y, len = sqrt(dx*dx + dy*dy);
+        double lo = -1e9, hi = 1e9;
+
+        if(len > 0
+                && clipLinear(-dy, dx*(y - a.y) + dy*a.x, -r*len, r*len, lo, hi)
+                && clipLinear(dx, dy*(y - a.y) - dx*a.x, 0, len*len, lo, hi)) {
+            x0 = std::min(x0, lo);
+            x1 = std::max(x1, hi);
+        }
+
+        return x0 <= x1;
     }
 
-    int upperBodyOutline(cv::Mat model, UpperBodySkeleton skel, Human* human) {
+    /* sum of a summed-area table over the half-open box [x0, x1) x [y0, y1) */
+    inline int integralSum(const cv::Mat& sat, int x0, int y0, int x1, int y1) {
+        return sat.at<int>(y1, x1) - sat.at<int>(y0, x1)
+             - sat.at<int>(y1, x0) + sat.at<int>(y0, x0);
+    }
+
+    /**
+     * sums a mask over the union of capsules around the given segments,
+     * without rasterizing them. sat is the mask's summed-area table (CV_32S).
+     * the union is walked in horizontal bands of `band` rows (1 is exact);
+     * each capsule covers one span per band, and overlapping spans are merged
+     * so shared pixels count once. cost is O(rows spanned), not O(frame).
+     */
+
+    int capsuleSum(const cv::Mat& sat, const cv::Point* lines, size_t count, int radius, int band) {
+        int rows = sat.rows - 1, cols = sat.cols - 1;
+        int top = rows, bottom = -1;
+
+        CV_Assert(count / 2 <= MAX_CAPSULES);
+
+        for(unsigned int i = 0; i < count; ++i) {
+            top = std::min(top, lines[i].y - radius);
+            bottom = std::max(bottom, lines[i].y + radius);
+        }
+
+        top = std::max(top, 0);
+        bottom = std::min(bottom, rows - 1);
+
+        int sum = 0;
+
+        for(int y0 = top; y0 <= bottom; y0 += band) {
+            int y1 = std::min(y0 + band, bottom + 1);
+
+            int spans[MAX_CAPSULES][2];
+            int spanCount = 0;
+
+            for(unsigned int i = 0; i < count; i += 2) {
+                cv::Point a = lines[i], b = lines[i + 1];
+
+                /* extremes over a band lie on its edges or on the cap centres */
+                int probes[] = { y0, y1 - 1, a.y, b.y };
+                double lo = 1e9, hi = -1e9;
+
+                for(unsigned int p = 0; p < countof(probes); ++p) {
+                    double l, h;
+
+                    if(probes[p] >= y0 && probes[p] < y1
+                            && capsuleRowSpan(a, b, radius, probes[p], l, h)) {
+                        lo = std::min(lo, l);
+                        hi = std::max(hi, h);
+                    }
+                }
+
+                int x0 = std::max(0, (int) ceil(lo)),
+                    x1 = std::min(cols - 1, (int) floor(hi));
+
+                if(x0 > x1) continue;
+
+                /* insert sorted by left edge */
+                int j = spanCount++;
+
+                for(; j > 0 && spans[j - 1][0] > x0; --j) {
+                    spans[j][0] = spans[j - 1][0];
+                    spans[j][1] = spans[j - 1][1];
+                }
+
+                spans[j][0] = x0;
+                spans[j][1] = x1;
+            }
+
+            /* merge overlapping spans and sum each once */
+            for(int i = 0; i < spanCount; ) {
+                int x0 = spans[i][0], x1 = spans[i][1];
+
+                for(++i; i < spanCount && spans[i][0] <= x1 + 1; ++i) {
+                    x1 = std::max(x1, spans[i][1]);
+                }
+
+                sum += integralSum(sat, x0, y0, x1 + 1, y1);
+            }
+        }
+
+        return sum;
+    }
+
+    /* lists the limb segments of the skeleton as point pairs; returns their length */
+
+    int upperBodySegments(cv::Point* lines, const int* skel, const Features2D& f) {
         cv::Point skeleton[] = {
-            human->projected.leftHand, jointPoint2(skel, JOINT_ELBOWL),
-            jointPoint2(skel, JOINT_ELBOWL), human->projected.leftShoulder,
+            f.leftHand, jointPoint2(skel, JOINT_ELBOWL),
+            jointPoint2(skel, JOINT_ELBOWL), f.leftShoulder,
 
-            human->projected.rightHand, jointPoint2(skel, JOINT_ELBOWR),
-            jointPoint2(skel, JOINT_ELBOWR), human->projected.rightShoulder
+            f.rightHand, jointPoint2(skel, JOINT_ELBOWR),
+            jointPoint2(skel, JOINT_ELBOWR), f.rightShoulder
         };
 
-        return drawModelOutline(model, skeleton, countof(skeleton));
+        int length = 0;
+
+        for(unsigned int i = 0; i < countof(skeleton); i += 2) {
+            lines[i] = skeleton[i];
+            lines[i + 1] = skeleton[i + 1];
+
+            length += cv::norm(skeleton[i] - skeleton[i + 1]);
+        }
+
+        return length;
+    }
+
+    /**
+     * chamfer cost of a set of segments: the integral along each segment of the
+     * distance to the nearest edge, truncated at CHAMFER_TRUNCATION. the distance
+     * transform is built once per frame, so each segment costs one lookup per
+     * CHAMFER_STEP pixels of its length. unlike counting covered edge pixels,
+     * this is smooth in the joint positions. the map covers the frame from
+     * origin; samples outside it count as misses. at pyramid level l the map
+     * is 2^l times smaller, so distances are scaled back to full-frame pixels
+     * and the cost stays comparable across levels
+     */
+
+    int chamferCost(const cv::Mat& chamfer, cv::Point origin, int level,
+                    const cv::Point* lines, size_t count) {
+        double scale = 1.0 / (1 << level);
+
+        double cost = 0;
+
+        for(unsigned int i = 0; i < count; i += 2) {
+            double dx = lines[i + 1].x - lines[i].x,
+                   dy = lines[i + 1].y - lines[i].y,
+                   len = sqrt(dx*dx + dy*dy);
+
+            int samples = std::max(1, (int) (len * scale / CHAMFER_STEP));
+            dx *= scale / samples;
+            dy *= scale / samples;
+
+            /* sample at the centre of each step */
+            double x = (lines[i].x - origin.x) * scale + dx / 2,
+                   y = (lines[i].y - origin.y) * scale + dy / 2;
+            double sum = 0;
+
+            for(int s = 0; s < samples; ++s, x += dx, y += dy) {
+                int px = cvRound(x), py = cvRound(y);
+
+                if(px >= 0 && py >= 0 && px < chamfer.cols && py < chamfer.rows) {
+                    sum += std::min(chamfer.at<float>(py, px) * (1 << level), (float) CHAMFER_TRUNCATION);
+                } else {
+                    sum += CHAMFER_TRUNCATION;
+                }
+            }
+
+            cost += sum * len / samples;
+        }
+
+        return cost;
     }
 
-    int costFunction2D(UpperBodySkeleton skel, void* humanPtr) {
-        Human* human = (Human*) humanPtr;
+    /**
+     * motion reward of a set of segments: the motion energy along each one,
+     * saturated at MOTION_SATURATION and scaled so a limb moving throughout
+     * earns back half of the chamfer cost of a complete miss. the energy map
+     * is full resolution at every level, but is sampled as sparsely as the
+     * level's chamfer map
+     */
+
+    int motionReward(const cv::Mat& motion, cv::Point origin, int level,
+                     const cv::Point* lines, size_t count) {
+        int step = CHAMFER_STEP << level;
+        double reward = 0;
+
+        for(unsigned int i = 0; i < count; i += 2) {
+            double dx = lines[i + 1].x - lines[i].x,
+                   dy = lines[i + 1].y - lines[i].y,
+                   len = sqrt(dx*dx + dy*dy);
+
+            int samples = std::max(1, (int) (len / step));
+            dx /= samples;
+            dy /= samples;
+
+            double x = lines[i].x - origin.x + dx / 2, y = lines[i].y - origin.y + dy / 2;
+            int sum = 0;
+
+            for(int s = 0; s < samples; ++s, x += dx, y += dy) {
+                int px = cvRound(x), py = cvRound(y);
+
+                if(px >= 0 && py >= 0 && px < motion.cols && py < motion.rows) {
+                    sum += std::min((int) motion.at<uchar>(py, px), (int) MOTION_SATURATION);
+                }
+            }
+
+            reward += (double) sum * len / samples;
+        }
+
+        return reward * CHAMFER_TRUNCATION / (2 * MOTION_SATURATION);
+    }
+
+    /**
+     * foreground support of a set of segments: the foreground pixels inside
+     * the union of the limb capsules, from the summed-area table, so each
+     * band of rows is a handful of lookups whatever the limbs' size. bands
+     * are as tall as the level's chamfer sampling step. scaled so a limb
+     * fully on the foreground earns back half the chamfer cost of a miss
+     */
+
+    int foregroundReward(const cv::Mat& sat, cv::Point origin, int level,
+                         const cv::Point* lines, size_t count) {
+        cv::Point local[MAX_CAPSULES * 2];
+
+        for(unsigned int i = 0; i < count; ++i) {
+            local[i] = lines[i] - origin;
+        }
+
+        int pixels = capsuleSum(sat, local, count, MODEL_RADIUS, CHAMFER_STEP << level) / 255;
+
+        return pixels * CHAMFER_TRUNCATION / (4 * MODEL_RADIUS);
+    }
+
+    /**
+     * the chamfer cost from edge points rather than a distance transform:
+     * the same integral, sampled as sparsely as the level's chamfer map,
+     * but with exact distances at every level
+     */
+
+    int chamferCost(const EdgeGrid& grid, int level, const cv::Point* lines, size_t count) {
+        int step = CHAMFER_STEP << level;
+        double cost = 0;
+
+        for(unsigned int i = 0; i < count; i += 2) {
+            double dx = lines[i + 1].x - lines[i].x,
+                   dy = lines[i + 1].y - lines[i].y,
+                   len = sqrt(dx*dx + dy*dy);
+
+            int samples = std::max(1, (int) (len / step));
+            dx /= samples;
+            dy /= samples;
+
+            double x = lines[i].x + dx / 2, y = lines[i].y + dy / 2;
+            double sum = 0;
 
-        /* draw the model outline with cost */
+            for(int s = 0; s < samples; ++s, x += dx, y += dy) {
+                sum += grid.nearest(cv::Point(cvRound(x), cvRound(y)));
+            }
+
+            cost += sum * len / samples;
+        }
 
-        cv::Mat model = cv::Mat::zeros(human->foreground.size(), CV_8U);
+        return cost;
+    }
 
-        int cost = upperBodyOutline(model, skel, human);
+    int costFunction2D(const int* skel, const Human& human, int level) {
+        cv::Point lines[UPPER_BODY_SEGMENTS * 2];
+        upperBodySegments(lines, skel, human.projected);
 
         /* reward outline, foreground, motion */
-        cost -= cv::countNonZero(human->edgeImage & model) / 4;
+        int cost = human.edgePoints.empty()
+                 ? chamferCost(human.chamfer[level], human.roi.tl(), level, lines, countof(lines))
+                 : chamferCost(human.edgePoints, level, lines, countof(lines));
+
+        if(!human.foregroundIntegral.empty()) {
+            cost -= foregroundReward(human.foregroundIntegral, human.roi.tl(), level, lines, countof(lines));
+        }
+
+        if(!human.motion.empty()) {
+            cost -= motionReward(human.motion, human.roi.tl(), level, lines, countof(lines));
+        }
 
         return cost;
     }
 
-    void Context::step() {
-        cv::Mat frame;
-        m_camera.read(frame);
+    /**
+     * capture stage: reads a frame and computes every per-frame map that
+     * depends only on the frame and the background. returns false once the
+     * source runs dry
+     *
+     * the maps cover only a padded box around the person found in the last
+     * frame. the whole frame is processed when there was nobody, and every
+     * ROI_REFRESH frames, to pick up newcomers and refresh the background
+     */
+
+    bool Context::capture(FrameSlot& slot) {
+        /* reading over the oldest frame is safe: the ring outlasts every
+         * slot that may still refer to one. a caller's frame from process()
+         * is let go rather than read over */
+        int index = (m_frameIndex + 1) % FRAME_RING;
+
+        if(m_borrowed[index]) {
+            m_frames[index].release();
+            m_borrowed[index] = false;
+        }
+
+        {
+            StageTimer timer(m_stats, STAGE_READ);
+            if(!m_source || !m_source->read(m_frames[index]) || m_frames[index].empty()) return false;
+        }
+
+        /* no background when the constructor's read failed; a stale one
+         * when the resolution changed. the frame then shows nobody */
+        if(m_background.size() != m_frames[index].size()) learnBackground(m_frames[index]);
+
+        analyze(slot, index);
+        return true;
+    }
+
+    Pose Context::process(const cv::Mat& frame) {
+        CV_Assert(!m_pipelined);
+
+        StageTimer timer(m_stats, STAGE_STEP);
+
+        Pose unfitted = currentPose();
+        unfitted.valid = false;
 
-        cv::Mat visualization = frame.clone();
-        
-        cv::Mat foreground = backgroundSubtract(frame);
-        cv::Mat skin = skinRegions(frame, foreground);
-        cv::Mat outline = edges(foreground) | edges(skin);
+        if(frame.empty()) return unfitted;
 
-        cv::imshow("Outline", outline);
+        /* the first frame, or the first at a new resolution, is only learnt */
+        if(m_background.size() != frame.size()) {
+            learnBackground(frame);
+            m_frames[m_frameIndex] = frame;
+            m_borrowed[m_frameIndex] = true;
 
-        track2DFeatures(skin);
+            return unfitted;
+        }
+
+        int index = (m_frameIndex + 1) % FRAME_RING;
+        m_frames[index] = frame;
+        m_borrowed[index] = true;
+
+        analyze(m_slots[0], index);
+        return fit(m_slots[0]);
+    }
+
+    /* computes the per-frame maps of ring frame index into the slot */
+
+    void Context::analyze(FrameSlot& slot, int index) {
+        cv::Mat previous = m_frames[m_frameIndex];
+        m_frameIndex = index;
+        slot.frame = m_frames[index];
+
+        Human& human = slot.human;
+        cv::Rect full(0, 0, slot.frame.cols, slot.frame.rows);
+
+        /* the setters may run on another thread; one reading each per frame
+         * keeps the frame's maps consistent */
+        bool trackRegion = m_trackRegion, edgePoints = m_edgePoints;
+        int levels = m_levels;
+
+        bool refresh = !trackRegion || m_roi.area() == 0 || m_roiAge >= ROI_REFRESH;
+        human.roi = refresh ? full : m_roi;
+        m_roiAge = refresh ? 0 : m_roiAge + 1;
+
+        MatArena& arena = slot.arena;
+
+        {
+            StageTimer timer(m_stats, STAGE_SEGMENT);
+            segment(slot.frame, previous, human.roi, arena,
+                    human.foreground, human.skinRegions, human.motion);
+        }
+
+        {
+            StageTimer timer(m_stats, STAGE_EDGES);
+            human.edgeImage = edges(human.foreground, human.skinRegions, arena);
+        }
+
+        StageTimer timer(m_stats, STAGE_DISTANCE);
+
+        human.foregroundIntegral = arena.get(MatArena::BUFFER_FOREGROUND_INTEGRAL,
+                                             cv::Size(human.roi.width + 1, human.roi.height + 1), CV_32S);
+        cv::integral(human.foreground, human.foregroundIntegral, CV_32S);
+
+        human.levels = levels;
+
+        /* the sparse path buckets the edge pixels instead; every level
+         * looks up the same grid */
+        if(edgePoints) {
+            human.edgePoints.build(human.edgeImage, human.roi.tl());
+
+            for(int level = 0; level < MAX_PYRAMID_LEVELS; ++level) {
+                human.chamfer[level].release();
+            }
+        } else {
+            human.edgePoints.clear();
+        }
 
-        Human human(foreground, skin, outline, m_last2D);
+        /* area-averaging keeps any edge pixel alive in the coarser levels */
+        cv::Mat edgeLevel = human.edgeImage;
 
-        optimizeRandomSearch(costFunction2D,
-                             countof(m_skeleton),
-                             25, 50,
-                             m_skeleton,
-                             (void*) &human);
+        for(int level = 0; level < levels && !edgePoints; ++level) {
+            cv::Size size = edgeLevel.size();
 
-        visualizeUpperSkeleton(visualization, m_last2D, m_skeleton);
-        cv::imshow("visualization", visualization);
+            if(level > 0) {
+                size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+
+                cv::Mat coarser = arena.get(MatArena::BUFFER_EDGE_LEVEL + level, size, CV_8U);
+                cv::resize(edgeLevel, coarser, size, 0, 0, cv::INTER_AREA);
+                edgeLevel = coarser;
+            }
+
+            cv::Mat nonEdges = arena.get(MatArena::BUFFER_NON_EDGES, size, CV_8U);
+            cv::compare(edgeLevel, cv::Scalar(0), nonEdges, cv::CMP_EQ);
+
+            human.chamfer[level] = arena.get(MatArena::BUFFER_CHAMFER + level, size, CV_32F);
+            cv::distanceTransform(nonEdges, human.chamfer[level], CV_DIST_L2, CV_DIST_MASK_5);
+        }
+
+        /* pad the foreground's extent for the next frame, or lose the track */
+        cv::Rect extent = cv::boundingRect(human.foreground);
+
+        if(extent.area() > 0) {
+            int padX = ROI_PADDING + extent.width / 4,
+                padY = ROI_PADDING + extent.height / 4;
+
+            m_roi = cv::Rect(extent.x + human.roi.x - padX, extent.y + human.roi.y - padY,
+                             extent.width + 2*padX, extent.height + 2*padY) & full;
+        } else {
+            m_roi = cv::Rect();
+        }
+    }
+
+    /**
+     * fitting stage: tracks features and optimizes the skeleton, which both
+     * carry state from frame to frame
+     */
+
+    Pose Context::fit(FrameSlot& slot) {
+        Human& human = slot.human;
+
+        {
+            StageTimer timer(m_stats, STAGE_TRACK);
+            track2DFeatures(human.skinRegions, human.roi, slot.frame.size(), slot.arena);
+        }
+
+        human.projected = m_last2D;
+
+        {
+            StageTimer timer(m_stats, STAGE_OPTIMIZE);
+
+            /* coarse levels find the basin cheaply with a wide radius; each
+             * finer level refines from there */
+            for(int level = human.levels - 1; level >= 0; --level) {
+                OptimizerParams params = levelParams<countof(m_skeleton)>(m_optimizer, human.levels, level);
+
+                optimize<countof(m_skeleton)>(
+                        params,
+                        [&human, level](const int* skel) { return costFunction2D(skel, human, level); },
+                        m_skeleton,
+                        m_random,
+                        PoolFor(m_pool, timer.helpers()));
+            }
+        }
+
+        Pose pose = currentPose();
+
+        /* visualization is opt-in; headless contexts skip it entirely */
+        if(m_sink) {
+            StageTimer timer(m_stats, STAGE_VISUALIZE);
+            m_sink(slot.frame, human, pose);
+        }
+
+        return pose;
+    }
+
+    Pose Context::currentPose() const {
+        Pose pose;
+        pose.features = m_last2D;
+        memcpy(pose.skeleton, m_skeleton, sizeof(m_skeleton));
+        pose.valid = true;
+
+        return pose;
+    }
+
+    /* once the camera runs dry, step() keeps returning the last pose, marked invalid */
+
+    Pose Context::step() {
+        StageTimer timer(m_stats, STAGE_STEP);
+
+        Pose dry = currentPose();
+        dry.valid = false;
+
+        if(!m_pipelined) {
+            return capture(m_slots[0]) ? fit(m_slots[0]) : dry;
+        }
+
+        int slot;
+
+        if(!waitPop(m_captured, slot, m_capturing)) {
+            /* the capture thread stopped; take what it left */
+            if(!m_captured.pop(slot)) return dry;
+        }
+
+        Pose pose = fit(m_slots[slot]);
+        m_free.push(slot);
+
+        return pose;
+    }
+
+    /**
+     * pipelined mode: a dedicated thread captures and segments frames into
+     * free slots while step() fits the oldest captured one, so segmentation
+     * of frame N+1 overlaps with optimization of frame N. both stages keep
+     * their own state and frames stay in order, so results are unchanged
+     */
+
+    void Context::setPipelined(bool pipelined) {
+        /* stop any capture thread, including one that ran out of frames;
+         * frames it captured ahead are dropped */
+        if(m_captureThread.joinable()) {
+            m_capturing = false;
+            m_captureThread.join();
+        }
+
+        m_pipelined = pipelined;
+
+        if(pipelined) {
+            int slot;
+            while(m_captured.pop(slot)) {}
+            while(m_free.pop(slot)) {}
+
+            for(int i = 0; i < PIPELINE_DEPTH; ++i) m_free.push(i);
+
+            m_capturing = true;
+            m_captureThread = std::thread(&Context::captureLoop, this);
+        }
+    }
+
+    void Context::captureLoop() {
+        int slot;
+
+        while(waitPop(m_free, slot, m_capturing)) {
+            if(!capture(m_slots[slot])) break;
+
+            m_captured.push(slot);
+        }
+
+        m_capturing = false;
+    }
+
+    Context::~Context() {
+        setPipelined(false);
+    }
+
+    void Context::seed(uint64_t seed) {
+        m_random.seed(seed);
+    }
+
+    void Context::setRegionTracking(bool enabled) {
+        m_trackRegion = enabled;
+    }
+
+    uint64_t Context::allocations() const {
+        uint64_t total = 0;
+
+        for(int i = 0; i < PIPELINE_DEPTH; ++i) total += m_slots[i].arena.allocations();
+
+        return total;
+    }
+
+    StageStats Context::stats(Stage stage) const {
+        return m_stats.histograms[stage].summary();
+    }
+
+    void Context::resetStats() {
+        for(int i = 0; i < STAGE_COUNT; ++i) m_stats.histograms[i].reset();
+        m_stats.reset();
+    }
+
+    bool Context::setPerfCounters(bool enabled) {
+        PerfSample probe;
+        bool available = readPerfCounters(probe);
+
+        m_stats.counting = enabled && available;
+        return available;
+    }
+
+    StagePerf Context::perf(Stage stage) const {
+        return m_stats.perf(stage);
+    }
+
+    void Context::setEdgePoints(bool enabled) {
+        m_edgePoints = enabled;
+    }
+
+    void Context::setPyramidLevels(int levels) {
+        m_levels = std::max(1, std::min(levels, (int) MAX_PYRAMID_LEVELS));
+    }
+
+    void Context::setThreadPool(ThreadPool* pool) {
+        m_pool = pool;
+    }
+
+    void Context::setOptimizer(const OptimizerParams& params) {
+        m_optimizer = params;
+    }
 
-        m_lastFrame = frame.clone();
+    void Context::setVisualizationSink(VisualizationSink sink) {
+        m_sink = sink;
     }
 
-    void visualizeUpperSkeleton(cv::Mat out, Features2D f, UpperBodySkeleton skel) {
+    void visualizeUpperSkeleton(cv::Mat out, Features2D f, const UpperBodySkeleton skel) {
         cv::Scalar c(0, 200, 0); /* color */
         int t = 5; /* line thickness */
 
@@ -0,0 +1,251 @@
+/**
+ * allocations.cpp
+ * Checks that uPose does not allocate once frames are steady.
+ * This file is part of uPose.
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ *
+ * Usage:
+ * $ ./test/allocations
+ *
+ * Every heap allocation in the process is counted, through operator new and
+ * through the default cv::Mat allocator, on every thread. The code uPose
+ * owns (segmentation, background update, blob statistics and outlines,
+ * cost function and optimizers, in series and on a pool) must not allocate
+ * at all after a warm-up call. Exits non-zero on a failure.
+ *
+ * A whole step is not a zero-allocation check: it also runs OpenCV kernels
+ * (morphology, distance transforms, connected components) that allocate
+ * scratch buffers of their own on every call, in numbers that vary across
+ * OpenCV versions and builds. For a step, only the context's own buffers
+ * are checked, which must stop growing; the heap and Mat allocations per
+ * frame are printed, not asserted.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <upose.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+
+#include "scene.h"
+
+enum {
+    STEADY_CALLS = 100, /* calls counted per check, after one to warm up */
+    STEADY_FRAMES = 3 * upose::ROI_REFRESH /* frames counted for a whole step */
+};
+
+static std::atomic<uint64_t> heapAllocations(0), matAllocations(0);
+
+void* operator new(size_t size) {
+    ++heapAllocations;
+
+    void* memory = malloc(size ? size : 1);
+    if(!memory) throw std::bad_alloc();
+
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+/* counts new Mat buffers, handing the work to OpenCV's own allocator */
+
+class CountingAllocator : public cv::MatAllocator {
+    public:
+        explicit CountingAllocator(cv::MatAllocator* base) : m_base(base) {}
+
+        cv::UMatData* allocate(int dims, const int* sizes, int type, void* data,
+                               size_t* step, int flags, cv::UMatUsageFlags usage) const {
+            if(!data) ++matAllocations;
+
+            return m_base->allocate(dims, sizes, type, data, step, flags, usage);
+        }
+
+        bool allocate(cv::UMatData* data, int access, cv::UMatUsageFlags usage) const {
+            return m_base->allocate(data, access, usage);
+        }
+
+        void deallocate(cv::UMatData* data) const {
+            m_base->deallocate(data);
+        }
+
+    private:
+        cv::MatAllocator* m_base;
+};
+
+/* calls fn once to warm up, then counts its allocations over STEADY_CALLS calls */
+
+template<typename F>
+static bool steady(const char* name, F fn) {
+    fn();
+
+    uint64_t heap = heapAllocations, mats = matAllocations;
+
+    for(int i = 0; i < STEADY_CALLS; ++i) fn();
+
+    heap = heapAllocations - heap;
+    mats = matAllocations - mats;
+
+    bool passed = heap == 0 && mats == 0;
+
+    printf("%-32s %s: %llu heap, %llu Mat allocations in %d calls\n", name, passed ? "ok" : "FAILED",
+           (unsigned long long) heap, (unsigned long long) mats, STEADY_CALLS);
+
+    return passed;
+}
+
+int main() {
+    static CountingAllocator counting(cv::Mat::getDefaultAllocator());
+    cv::Mat::setDefaultAllocator(&counting);
+
+    cv::Mat background;
+    std::vector<cv::Mat> frames;
+    syntheticScene(cv::Size(640, 480), background, frames);
+
+    int failures = 0, next = 0;
+
+    /* each call takes the next frame and its predecessor */
+    auto frame = [&]() -> const cv::Mat& { return frames[next]; };
+    auto previous = [&]() -> const cv::Mat& { return frames[(next + SCENE_FRAMES - 1) % SCENE_FRAMES]; };
+    auto advance = [&]() { next = (next + 1) % SCENE_FRAMES; };
+
+    cv::Mat foreground, skin, motion;
+
+    failures += !steady("segment_pixels", [&]() {
+        upose::segmentPixels(frame(), background, previous(), foreground, skin, motion);
+        advance();
+    });
+
+    cv::Mat model = background.clone(), fraction = cv::Mat::zeros(background.size(), CV_8UC3);
+
+    failures += !steady("update_background", [&]() {
+        upose::updateBackground(frame(), foreground, model, fraction);
+        advance();
+    });
+
+    /* the skin blobs of a frame, as track2DFeatures finds them */
+    cv::Mat labels;
+    int blobs = cv::connectedComponents(skin, labels, 8, CV_32S);
+
+    upose::BlobStats stats;
+    std::vector<cv::Point> outline;
+
+    failures += !steady("blob_stats", [&]() {
+        stats.load(labels, blobs, cv::Point(0, 0));
+    });
+
+    failures += !steady("trace_outline", [&]() {
+        for(size_t i = 0; i < stats.size(); ++i) {
+            upose::traceOutline(labels, i + 1, stats.box[i], cv::Point(0, 0), outline);
+        }
+    });
+
+    /* the maps of a frame, for the cost function */
+    upose::Human human;
+    human.roi = cv::Rect(cv::Point(0, 0), background.size());
+    human.foreground = foreground;
+    human.motion = motion;
+    human.edgeImage = foreground != 0;
+
+    cv::distanceTransform(human.edgeImage == 0, human.chamfer[0], CV_DIST_L2, CV_DIST_MASK_5);
+    cv::integral(foreground, human.foregroundIntegral, CV_32S);
+
+    cv::Point neck(background.cols / 2, background.rows / 3);
+    human.projected.leftShoulder = neck + cv::Point(-80, 20);
+    human.projected.rightShoulder = neck + cv::Point(80, 20);
+    human.projected.leftHand = neck + cv::Point(-200, 120);
+    human.projected.rightHand = neck + cv::Point(200, 120);
+
+    int guess[] = { neck.x - 120, neck.y + 100, neck.x + 120, neck.y + 100 };
+    volatile int sink = 0;
+
+    failures += !steady("cost_function", [&]() {
+        sink += upose::costFunction2D(guess, human);
+    });
+
+    upose::ThreadPool pool(4);
+    upose::Random random(1);
+
+    struct { upose::Optimizer method; const char* name; } optimizers[] = {
+        { upose::OPTIMIZER_COORDINATE_DESCENT, "coordinate_descent" },
+        { upose::OPTIMIZER_NELDER_MEAD, "nelder_mead" },
+        { upose::OPTIMIZER_CMA_ES, "cma_es" },
+        { upose::OPTIMIZER_PARTICLE_SWARM, "particle_swarm" },
+        { upose::OPTIMIZER_BATCH_SEARCH, "batch_search" }
+    };
+
+    /* through PoolFor, as a step fits, with and without the pool */
+    for(unsigned int i = 0; i < countof(optimizers); ++i) {
+        upose::OptimizerParams params(optimizers[i].method);
+
+        for(int pooled = 0; pooled < 2; ++pooled) {
+            char name[64];
+            snprintf(name, sizeof(name), "optimize_%s%s", optimizers[i].name, pooled ? "_pooled" : "");
+
+            upose::PoolFor parallel(pooled ? &pool : NULL);
+
+            failures += !steady(name, [&]() {
+                int fitted[countof(guess)];
+                memcpy(fitted, guess, sizeof(guess));
+
+                upose::optimize<countof(guess)>(
+                        params,
+                        [&human](const int* skel) { return upose::costFunction2D(skel, human); },
+                        fitted,
+                        random,
+                        parallel);
+            });
+        }
+    }
+
+    /* whole steps, with every option that touches the per-frame buffers.
+     * not a zero-allocation check; see the top of the file */
+    upose::Context context;
+    context.setThreadPool(&pool);
+    context.setOptimizer(upose::OptimizerParams(upose::OPTIMIZER_BATCH_SEARCH));
+    context.setPyramidLevels(2);
+    context.setEdgePoints(true);
+
+    (void) context.process(background);
+
+    /* past a full-frame refresh, so every buffer has reached its size */
+    for(int i = 0; i < 2 * upose::ROI_REFRESH; ++i) {
+        (void) context.process(frame());
+        advance();
+    }
+
+    uint64_t buffers = context.allocations(), heap = heapAllocations, mats = matAllocations;
+
+    for(int i = 0; i < STEADY_FRAMES; ++i) {
+        (void) context.process(frame());
+        advance();
+    }
+
+    buffers = context.allocations() - buffers;
+    heap = heapAllocations - heap;
+    mats = matAllocations - mats;
+
+    printf("%-32s %s: %llu arena allocations in %d frames\n", "step", buffers ? "FAILED" : "ok",
+           (unsigned long long) buffers, STEADY_FRAMES);
+    printf("%-32s %.1f heap, %.1f Mat allocations per frame, not checked\n", "",
+           (double) heap / STEADY_FRAMES, (double) mats / STEADY_FRAMES);
+
+    failures += buffers != 0;
+
+    return failures ? 1 : 0;
+}
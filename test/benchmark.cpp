@@ -0,0 +1,355 @@
+/**
+ * benchmark.cpp
+ * Per-stage benchmarks for the uPose pipeline, as JSON.
+ * This file is part of uPose.
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ *
+ * Usage:
+ * $ ./test/benchmark [recording.y4m] > results.json
+ *
+ * Every stage runs on synthetic scenes at 480p, 720p and 1080p, and on the
+ * first frames of the recording, if given, at its own size. Each result is
+ * the mean time per call over about a second of repeated calls, with the
+ * mean hardware counts per call where the system provides them.
+ *
+ * segment_pixels runs with and without the motion cue, and the cost
+ * function is timed with its rewards added one at a time (chamfer, then
+ * foreground, then motion), so the price of each term shows, and then
+ * with the outline from edge points rather than a distance transform.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <upose.h>
+
+#include <stdio.h>
+
+#include "scene.h"
+
+/* the skin classifier as first written, with cv::Mat expressions */
+
+static cv::Mat legacySkin(cv::Mat frame) {
+    cv::Mat bgr[3];
+    cv::split(frame, bgr);
+
+    cv::Mat map = (0.6*bgr[2]) - (0.3*bgr[1]) - (0.3*bgr[0]);
+    return (map > 1) & (map < 16);
+}
+
+/* mean cost of a call */
+
+struct Timing {
+    double seconds;
+
+    /* hardware counts, if counted */
+    bool counted;
+    double cycles, instructions, cacheMisses, branchMisses;
+};
+
+/* calls fn repeatedly for about a second */
+
+template<typename F>
+static Timing timeCall(F fn) {
+    fn(); /* warm up caches and allocations */
+
+    upose::PerfSample before, after;
+    bool counted = upose::readPerfCounters(before);
+
+    int64_t start = cv::getTickCount();
+    double elapsed = 0;
+    int calls = 0;
+
+    while(elapsed < 1.0) {
+        fn();
+        ++calls;
+
+        elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+    }
+
+    counted = counted && upose::readPerfCounters(after);
+
+    Timing timing = { elapsed / calls, counted, 0, 0, 0, 0 };
+
+    if(counted) {
+        timing.cycles = (double) (after.cycles - before.cycles) / calls;
+        timing.instructions = (double) (after.instructions - before.instructions) / calls;
+        timing.cacheMisses = (double) (after.cacheMisses - before.cacheMisses) / calls;
+        timing.branchMisses = (double) (after.branchMisses - before.branchMisses) / calls;
+    }
+
+    return timing;
+}
+
+/**
+ * as timeCall, for stages that change their own state as they run: calls
+ * reset, untimed, before every batch of calls, and fn batch times in each
+ */
+
+template<typename F, typename R>
+static Timing timeBatches(F fn, R reset, int batch) {
+    reset();
+    fn(); /* warm up caches and allocations */
+
+    upose::PerfSample before = { 0, 0, 0, 0 }, after = before, total = before;
+    bool counted = true;
+
+    double elapsed = 0;
+    int calls = 0;
+
+    while(elapsed < 1.0) {
+        reset();
+
+        counted = counted && upose::readPerfCounters(before);
+        int64_t start = cv::getTickCount();
+
+        for(int i = 0; i < batch; ++i) fn();
+
+        elapsed += (cv::getTickCount() - start) / cv::getTickFrequency();
+        counted = counted && upose::readPerfCounters(after);
+        calls += batch;
+
+        total.cycles += after.cycles - before.cycles;
+        total.instructions += after.instructions - before.instructions;
+        total.cacheMisses += after.cacheMisses - before.cacheMisses;
+        total.branchMisses += after.branchMisses - before.branchMisses;
+    }
+
+    Timing timing = { elapsed / calls, counted, 0, 0, 0, 0 };
+
+    if(counted) {
+        timing.cycles = (double) total.cycles / calls;
+        timing.instructions = (double) total.instructions / calls;
+        timing.cacheMisses = (double) total.cacheMisses / calls;
+        timing.branchMisses = (double) total.branchMisses / calls;
+    }
+
+    return timing;
+}
+
+/* prints one result as a JSON object in the benchmarks array */
+
+static void report(const char* stage, const char* source, cv::Size size, const Timing& timing) {
+    static bool first = true;
+
+    printf("%s\n    {\"stage\": \"%s\", \"source\": \"%s\", \"width\": %d, \"height\": %d, "
+           "\"ns_per_call\": %.0f, \"mpix_per_s\": %.2f",
+           first ? "" : ",", stage, source, size.width, size.height,
+           timing.seconds * 1e9, size.area() / 1e6 / timing.seconds);
+
+    /* instructions per cycle and misses per thousand instructions tell
+     * compute-bound stages from memory-bound ones */
+    if(timing.counted) {
+        printf(", \"cycles\": %.0f, \"instructions\": %.0f, \"cache_misses\": %.0f, \"branch_misses\": %.0f, "
+               "\"ipc\": %.2f, \"cache_mpki\": %.2f",
+               timing.cycles, timing.instructions, timing.cacheMisses, timing.branchMisses,
+               timing.cycles > 0 ? timing.instructions / timing.cycles : 0,
+               timing.instructions > 0 ? 1000 * timing.cacheMisses / timing.instructions : 0);
+    }
+
+    printf("}");
+    first = false;
+}
+
+/* the per-frame maps of costFunction2D, built as a step would */
+
+static void buildHuman(upose::Human& human, cv::Mat foreground, cv::Mat edges, cv::Mat motion) {
+    human.roi = cv::Rect(cv::Point(0, 0), foreground.size());
+    human.foreground = foreground;
+    human.edgeImage = edges;
+    human.motion = motion;
+    human.levels = 1;
+
+    cv::distanceTransform(edges == 0, human.chamfer[0], CV_DIST_L2, CV_DIST_MASK_5);
+    cv::integral(foreground, human.foregroundIntegral, CV_32S);
+
+    /* a plausible figure in the middle of the frame */
+    cv::Size size = foreground.size();
+    cv::Point neck(size.width / 2, size.height / 3);
+    int unit = size.height / 12;
+
+    human.projected.leftShoulder = neck + cv::Point(-2*unit, unit / 2);
+    human.projected.rightShoulder = neck + cv::Point(2*unit, unit / 2);
+    human.projected.leftHand = neck + cv::Point(-5*unit, 3*unit);
+    human.projected.rightHand = neck + cv::Point(5*unit, 3*unit);
+}
+
+static void runSuite(const char* source, const cv::Mat& background, const std::vector<cv::Mat>& frames) {
+    cv::Size size = background.size();
+    cv::Rect full(cv::Point(0, 0), size);
+    unsigned int next = 0;
+
+    /* each call takes the next frame and its predecessor */
+    auto advance = [&]() { next = (next + 1) % frames.size(); };
+    auto frame = [&]() { return frames[next]; };
+    auto previous = [&]() { return frames[(next + frames.size() - 1) % frames.size()]; };
+
+    cv::Mat foreground, skin, motion;
+
+    report("legacy_skin", source, size, timeCall([&]() {
+        skin = legacySkin(frame());
+        advance();
+    }));
+
+    /* without a previous frame, as on a first frame, the motion cue is skipped */
+    report("segment_pixels_no_motion", source, size, timeCall([&]() {
+        upose::segmentPixels(frame(), background, cv::Mat(), foreground, skin, motion);
+        advance();
+    }));
+
+    report("segment_pixels", source, size, timeCall([&]() {
+        upose::segmentPixels(frame(), background, previous(), foreground, skin, motion);
+        advance();
+    }));
+
+    cv::Mat model = background.clone(), fraction = cv::Mat::zeros(size, CV_8UC3);
+
+    report("update_background", source, size, timeCall([&]() {
+        upose::updateBackground(frame(), foreground, model, fraction);
+        advance();
+    }));
+
+    /**
+     * the stages proper run on a context that learnt the background. the
+     * model absorbs a figure that keeps still within a few hundred updates
+     * (the face in about 150), after which the masks are all but empty, so
+     * stages that update it start over on a fresh context every ROI_REFRESH
+     * frames. that is also the mix of full-frame and tracked passes a live
+     * stream sees
+     */
+    std::unique_ptr<upose::Context> context;
+    upose::MatArena arena;
+
+    auto learn = [&]() {
+        context.reset(new upose::Context);
+        (void) context->process(background);
+    };
+
+    report("segment", source, size, timeBatches([&]() {
+        context->segment(frame(), previous(), full, arena, foreground, skin, motion);
+        advance();
+    }, learn, upose::ROI_REFRESH));
+
+    /* the later stages take the masks of one frame, segmented right after learning */
+    learn();
+    context->segment(frame(), previous(), full, arena, foreground, skin, motion);
+
+    cv::Mat edges;
+
+    report("edges", source, size, timeCall([&]() {
+        edges = context->edges(foreground, skin, arena);
+    }));
+
+    report("track_2d_features", source, size, timeCall([&]() {
+        context->track2DFeatures(skin, full, size, arena);
+    }));
+
+    upose::Human human;
+    buildHuman(human, foreground.clone(), edges.clone(), motion.clone());
+
+    int skeleton[] = {
+        human.projected.leftShoulder.x - size.height / 6, human.projected.leftShoulder.y + size.height / 6,
+        human.projected.rightShoulder.x + size.height / 6, human.projected.rightShoulder.y + size.height / 6
+    };
+
+    volatile int sink = 0;
+
+    /* the terms added one at a time; a missing map skips its term */
+    cv::Mat integral = human.foregroundIntegral, energy = human.motion;
+    human.foregroundIntegral.release();
+    human.motion.release();
+
+    report("cost_function_chamfer", source, size, timeCall([&]() {
+        sink += upose::costFunction2D(skeleton, human);
+    }));
+
+    human.foregroundIntegral = integral;
+
+    report("cost_function_foreground", source, size, timeCall([&]() {
+        sink += upose::costFunction2D(skeleton, human);
+    }));
+
+    human.motion = energy;
+
+    report("cost_function_motion", source, size, timeCall([&]() {
+        sink += upose::costFunction2D(skeleton, human);
+    }));
+
+    /* the sparse outline (setEdgePoints): bucketing replaces the distance
+     * transform, then each evaluation scans points */
+    report("edge_grid", source, size, timeCall([&]() {
+        human.edgePoints.build(human.edgeImage, full.tl());
+    }));
+
+    report("cost_function_sparse", source, size, timeCall([&]() {
+        sink += upose::costFunction2D(skeleton, human);
+    }));
+
+    human.edgePoints.clear();
+
+    struct { upose::Optimizer method; const char* name; } optimizers[] = {
+        { upose::OPTIMIZER_COORDINATE_DESCENT, "optimize_coordinate_descent" },
+        { upose::OPTIMIZER_NELDER_MEAD, "optimize_nelder_mead" },
+        { upose::OPTIMIZER_CMA_ES, "optimize_cma_es" },
+        { upose::OPTIMIZER_PARTICLE_SWARM, "optimize_particle_swarm" },
+        { upose::OPTIMIZER_BATCH_SEARCH, "optimize_batch_search" }
+    };
+
+    upose::Random random(1);
+
+    for(unsigned int i = 0; i < countof(optimizers); ++i) {
+        upose::OptimizerParams params(optimizers[i].method);
+
+        report(optimizers[i].name, source, size, timeCall([&]() {
+            int fitted[countof(skeleton)];
+            memcpy(fitted, skeleton, sizeof(skeleton));
+
+            upose::optimize<countof(skeleton)>(
+                    params,
+                    [&human](const int* skel) { return upose::costFunction2D(skel, human); },
+                    fitted,
+                    random);
+        }));
+    }
+
+    /* whole steps, likewise on a context learnt afresh every ROI_REFRESH frames */
+    report("step", source, size, timeBatches([&]() {
+        (void) context->process(frame());
+        advance();
+    }, learn, upose::ROI_REFRESH));
+}
+
+int main(int argc, char** argv) {
+    printf("{\"benchmarks\": [");
+
+    cv::Size sizes[] = { cv::Size(640, 480), cv::Size(1280, 720), cv::Size(1920, 1080) };
+
+    for(unsigned int i = 0; i < countof(sizes); ++i) {
+        cv::Mat background;
+        std::vector<cv::Mat> frames;
+
+        syntheticScene(sizes[i], background, frames);
+        runSuite("synthetic", background, frames);
+    }
+
+    /* a recording: its first frame serves as the empty background */
+    if(argc > 1) {
+        upose::Y4MSource recording(argv[1]);
+        cv::Mat background, frame;
+        std::vector<cv::Mat> frames;
+
+        if(recording.read(background)) {
+            while(frames.size() < SCENE_FRAMES && recording.read(frame)) {
+                frames.push_back(frame.clone());
+            }
+        }
+
+        if(!frames.empty()) {
+            runSuite("recorded", background, frames);
+        } else {
+            fprintf(stderr, "%s: no frames in %s\n", argv[0], argv[1]);
+        }
+    }
+
+    printf("\n]}\n");
+}
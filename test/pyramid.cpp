@@ -0,0 +1,136 @@
+/**
+ * pyramid.cpp
+ * Checks that every level of a coarse-to-fine fit does work.
+ * This file is part of uPose.
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ *
+ * Usage:
+ * $ ./test/pyramid
+ *
+ * Fits a skeleton over MAX_PYRAMID_LEVELS levels of the maps of synthetic
+ * frames with every optimizer and the default budget, as a step does. Each
+ * level must get at least the optimizer's minimum budget, and the finest
+ * level must move the skeleton on some frames; a level short of its
+ * minimum never does. Exits non-zero on a failure.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <upose.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "scene.h"
+
+enum {
+    LEVELS = upose::MAX_PYRAMID_LEVELS
+};
+
+/* the maps of a frame at every level, built as Context::analyze does */
+
+static void buildHuman(upose::Human& human, upose::Context& context, upose::MatArena& arena,
+                       const cv::Mat& frame, const cv::Mat& background, const cv::Mat& previous) {
+    cv::Mat foreground, skin, motion;
+    upose::segmentPixels(frame, background, previous, foreground, skin, motion);
+
+    human.roi = cv::Rect(cv::Point(0, 0), frame.size());
+    human.foreground = foreground;
+    human.skinRegions = skin;
+    human.motion = motion;
+    human.edgeImage = context.edges(foreground, skin, arena).clone();
+    human.levels = LEVELS;
+
+    cv::integral(foreground, human.foregroundIntegral, CV_32S);
+
+    cv::Mat edgeLevel = human.edgeImage;
+
+    for(int level = 0; level < LEVELS; ++level) {
+        if(level > 0) {
+            cv::Mat coarser;
+            cv::resize(edgeLevel, coarser, cv::Size((edgeLevel.cols + 1) / 2, (edgeLevel.rows + 1) / 2),
+                       0, 0, cv::INTER_AREA);
+            edgeLevel = coarser;
+        }
+
+        cv::distanceTransform(edgeLevel == 0, human.chamfer[level], CV_DIST_L2, CV_DIST_MASK_5);
+    }
+
+    /* a plausible figure in the middle of the frame */
+    cv::Point neck(frame.cols / 2, frame.rows / 3);
+    int unit = frame.rows / 12;
+
+    human.projected.leftShoulder = neck + cv::Point(-2*unit, unit / 2);
+    human.projected.rightShoulder = neck + cv::Point(2*unit, unit / 2);
+    human.projected.leftHand = neck + cv::Point(-5*unit, 3*unit);
+    human.projected.rightHand = neck + cv::Point(5*unit, 3*unit);
+}
+
+int main() {
+    cv::Mat background;
+    std::vector<cv::Mat> frames;
+    syntheticScene(cv::Size(640, 480), background, frames);
+
+    upose::Context context;
+    upose::MatArena arena;
+    std::vector<upose::Human> humans(SCENE_FRAMES);
+
+    for(int i = 0; i < SCENE_FRAMES; ++i) {
+        buildHuman(humans[i], context, arena, frames[i], background, frames[(i + SCENE_FRAMES - 1) % SCENE_FRAMES]);
+    }
+
+    struct { upose::Optimizer method; const char* name; } optimizers[] = {
+        { upose::OPTIMIZER_COORDINATE_DESCENT, "coordinate_descent" },
+        { upose::OPTIMIZER_NELDER_MEAD, "nelder_mead" },
+        { upose::OPTIMIZER_CMA_ES, "cma_es" },
+        { upose::OPTIMIZER_PARTICLE_SWARM, "particle_swarm" },
+        { upose::OPTIMIZER_BATCH_SEARCH, "batch_search" }
+    };
+
+    int failures = 0;
+
+    for(unsigned int i = 0; i < countof(optimizers); ++i) {
+        upose::OptimizerParams base(optimizers[i].method);
+        upose::Random random(1);
+
+        const int N = sizeof(upose::UpperBodySkeleton) / sizeof(int);
+        int least = upose::minimumEvaluations<N>(base), shortest = INT_MAX, moved = 0;
+
+        for(int f = 0; f < SCENE_FRAMES; ++f) {
+            const upose::Human& human = humans[f];
+
+            /* elbows well off the figure, as after losing the track */
+            int unit = background.rows / 12;
+            upose::UpperBodySkeleton skeleton = {
+                human.projected.leftShoulder.x - 2*unit, human.projected.leftShoulder.y + 3*unit,
+                human.projected.rightShoulder.x + 2*unit, human.projected.rightShoulder.y + 3*unit
+            };
+
+            for(int level = LEVELS - 1; level >= 0; --level) {
+                upose::OptimizerParams params = upose::levelParams<N>(base, LEVELS, level);
+                shortest = std::min(shortest, params.evaluations);
+
+                upose::UpperBodySkeleton before;
+                memcpy(before, skeleton, sizeof(skeleton));
+
+                upose::optimize<N>(
+                        params,
+                        [&human, level](const int* skel) { return upose::costFunction2D(skel, human, level); },
+                        skeleton,
+                        random);
+
+                if(level == 0 && memcmp(before, skeleton, sizeof(skeleton))) ++moved;
+            }
+        }
+
+        bool passed = shortest >= least && moved > 0;
+
+        printf("%-20s %s: at least %d evaluations per level (minimum %d), level 0 moved on %d of %d frames\n",
+               optimizers[i].name, passed ? "ok" : "FAILED", shortest, least, moved, SCENE_FRAMES);
+
+        failures += !passed;
+    }
+
+    return failures ? 1 : 0;
+}
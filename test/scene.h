@@ -0,0 +1,57 @@
+/**
+ * scene.h
+ * synthetic frames shared by the tests and benchmarks
+ * This file is part of uPose.
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ */
+
+#ifndef UPOSE_TEST_SCENE_H
+#define UPOSE_TEST_SCENE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+enum {
+    SCENE_FRAMES = 30 /* frames per scene; callers cycle through them */
+};
+
+/**
+ * a bright textured background and a dark-clothed figure with a
+ * skin-coloured face and hands, which wave from frame to frame
+ */
+
+static inline void syntheticScene(cv::Size size, cv::Mat& background, std::vector<cv::Mat>& frames) {
+    background.create(size, CV_8UC3);
+    cv::randu(background, cv::Scalar::all(215), cv::Scalar::all(256));
+    cv::GaussianBlur(background, background, cv::Size(5, 5), 0);
+
+    cv::Scalar clothing(60, 40, 40), skin(160, 175, 190);
+    int unit = size.height / 12;
+
+    frames.resize(SCENE_FRAMES);
+
+    for(int i = 0; i < SCENE_FRAMES; ++i) {
+        cv::Mat& frame = frames[i];
+        frame = background.clone();
+
+        cv::Point neck(size.width / 2, size.height / 3);
+        double wave = sin(2 * CV_PI * i / SCENE_FRAMES);
+
+        cv::rectangle(frame, cv::Rect(neck.x - 2*unit, neck.y, 4*unit, 6*unit), clothing, -1);
+        cv::ellipse(frame, neck - cv::Point(0, unit), cv::Size(unit * 3/4, unit), 0, 0, 360, skin, -1);
+
+        for(int side = -1; side <= 1; side += 2) {
+            cv::Point shoulder = neck + cv::Point(side * 2*unit, unit / 2),
+                      elbow = shoulder + cv::Point(side * 2*unit, 2*unit),
+                      hand = elbow + cv::Point(side * unit, (int) (-3*unit * wave));
+
+            cv::line(frame, shoulder, elbow, clothing, unit);
+            cv::line(frame, elbow, hand, clothing, unit * 3/4);
+            cv::circle(frame, hand, unit / 2, skin, -1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,66 @@
+/**
+ * streams.cpp
+ * Checks that a StreamPool shares its workers fairly between streams.
+ * This file is part of uPose.
+ *
+ * Copyright (C) 2016 Alyssa Rosenzweig
+ * ALL RIGHTS RESERVED
+ *
+ * Usage:
+ * $ ./test/streams
+ *
+ * Steps more endless streams than there are workers for a while, then
+ * compares the frames each stream got. Every stream must get at least
+ * half the frames of the busiest. Exits non-zero on a failure.
+ */
+
+#include <opencv2/opencv.hpp>
+#include <upose.h>
+
+#include <stdio.h>
+
+#include "scene.h"
+
+enum {
+    THREADS = 4,
+    STREAMS = 3 * THREADS,
+    SECONDS = 2
+};
+
+int main() {
+    cv::Mat background;
+    std::vector<cv::Mat> frames;
+    syntheticScene(cv::Size(160, 120), background, frames);
+
+    upose::ThreadPool threads(THREADS);
+    upose::StreamPool pool(threads);
+
+    std::vector<std::unique_ptr<upose::MemorySource> > sources;
+
+    for(int i = 0; i < STREAMS; ++i) {
+        sources.push_back(std::unique_ptr<upose::MemorySource>(new upose::MemorySource(frames, true)));
+        pool.add(*sources.back(), i + 1);
+    }
+
+    pool.start();
+    std::this_thread::sleep_for(std::chrono::seconds(SECONDS));
+    pool.stop();
+
+    upose::StreamPool::Throughput t = pool.throughput();
+
+    uint64_t least = t.streamFrames[0], most = t.streamFrames[0];
+
+    for(int i = 0; i < STREAMS; ++i) {
+        least = std::min(least, t.streamFrames[i]);
+        most = std::max(most, t.streamFrames[i]);
+
+        printf("stream %2d: %llu frames\n", i, (unsigned long long) t.streamFrames[i]);
+    }
+
+    bool passed = least > 0 && 2 * least >= most;
+
+    printf("%s: %d streams on %d threads, %llu to %llu frames each\n", passed ? "ok" : "FAILED",
+           STREAMS, THREADS, (unsigned long long) least, (unsigned long long) most);
+
+    return passed ? 0 : 1;
+}
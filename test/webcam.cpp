@@ -7,7 +7,9 @@
  * ALL RIGHTS RESERVED
  *
  * Usage:
- * $ ./test/webcam
+ * $ ./test/webcam [trace.json]
+ *
+ * Given a path, a Chrome trace of the last frames is written there on exit.
  */
 
 #include <opencv2/opencv.hpp>
@@ -16,16 +18,33 @@
 #include <stdio.h>
 #include <time.h>
 
+/* shows the outline and skeleton in HighGUI windows */
+
+static void showVisualization(cv::Mat frame, const upose::Human& human, const upose::Pose& pose) {
+    cv::Mat outline = cv::Mat::zeros(frame.size(), CV_8U);
+    human.edgeImage.copyTo(outline(human.roi));
+    cv::imshow("Outline", outline);
+
+    cv::Mat visualization = frame.clone();
+    upose::visualizeUpperSkeleton(visualization, pose.features, pose.skeleton);
+    cv::imshow("visualization", visualization);
+}
+
 int main(int argc, char** argv) {
     cv::VideoCapture camera(0);
 
+    if(argc > 1) upose::Tracer::enable(true);
+
     upose::Context context(camera);
+    context.setVisualizationSink(showVisualization);
+
+    bool counting = context.setPerfCounters(true);
 
     time_t timer = time(0);
     unsigned int count = 0;
 
     for(;;) {
-        (void) context.step();
+        if(!context.step().valid) break;
 
         ++count;
 
@@ -34,4 +53,28 @@ int main(int argc, char** argv) {
 
         if(cv::waitKey(1) == 27) break;
     }
+
+    printf("\n");
+
+    for(int i = 0; i < upose::STAGE_COUNT; ++i) {
+        upose::StageStats stats = context.stats((upose::Stage) i);
+
+        printf("%-10s p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n",
+               upose::stageName((upose::Stage) i),
+               stats.p50 / 1e6, stats.p90 / 1e6, stats.p99 / 1e6, stats.max / 1e6);
+
+        upose::StagePerf perf = context.perf((upose::Stage) i);
+
+        if(counting && perf.runs > 0 && perf.total.cycles > 0) {
+            printf("%-10s per run: %.2f Mcycles, IPC %.2f, %.1f K cache misses, %.1f K branch misses\n", "",
+                   perf.total.cycles / 1e6 / perf.runs,
+                   (double) perf.total.instructions / perf.total.cycles,
+                   perf.total.cacheMisses / 1e3 / perf.runs,
+                   perf.total.branchMisses / 1e3 / perf.runs);
+        }
+    }
+
+    if(argc > 1 && !upose::Tracer::dump(argv[1])) {
+        fprintf(stderr, "%s: cannot write %s\n", argv[0], argv[1]);
+    }
 }